@@ -5,185 +5,2158 @@
 // No excuses of internet issue / msteams  issue / visual studio or hardware issue or electricity issue will be entertained.
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <climits>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "framebuffer.h"
+#include "depth_buffer.h"
+#include "mesh_io.h"
+#include "ppm_io.h"
+#include "texture.h"
+#include "face_queue.h"
+#include "transform.h"
+#include "msaa.h"
+#include "obj_io.h"
+#include "pick_index.h"
+#include "fragment_buffer.h"
 
 using namespace std;
 
-// Structure to store vertex information (x, y coordinates)
-struct Vertex {
-    int x, y;
+// Function to read the input file; OBJ models are fitted to an image whose longer
+// side is objImageSize pixels
+void readInputFile(const string& filename, LoadedMesh& mesh, int objImageSize) {
+    string error;
+    bool loaded = isObjFile(filename) ? loadObjMesh(filename, objImageSize, mesh, error) : loadMesh(filename, mesh, error);
+    if (!loaded) {
+        cerr << "Error: " << error << endl;
+        exit(1); // Exit if the file cannot be opened or parsed
+    }
+}
+
+// Floor and ceiling of an integer division (C++ division truncates towards zero)
+long long floorDiv(long long num, long long den) {
+    long long q = num / den;
+    if ((num % den != 0) && ((num < 0) != (den < 0))) --q;
+    return q;
+}
+
+long long ceilDiv(long long num, long long den) {
+    long long q = num / den;
+    if ((num % den != 0) && ((num < 0) == (den < 0))) ++q;
+    return q;
+}
+
+// Edge function E(x, y) = A * x + B * y + C of one triangle edge, oriented so that
+// E >= 0 on the inside of the triangle
+struct Edge {
+    long long A, B, C;
 };
 
-// Structure to store face information (triangle defined by 3 vertices and their colors)
-struct Face {
-    int v1, v2, v3; // Vertex indices (1-based)
-    int colors[9];  // RGB colors for each vertex (3 vertices × 3 RGB values)
+// Plane equation of an attribute over the screen, relative to vertex a of the
+// triangle: value(x, y) = atA + dx * (x - a.x) + dy * (y - a.y)
+struct AttributePlane {
+    double atA, dx, dy;
 };
 
-// Function to read the input file
-void readInputFile(const string& filename, int& width, int& height, Vertex*& vertices, int& numVertices, Face*& faces, int& numFaces) {
-    ifstream file(filename); // Open the input file
-    if (!file.is_open()) {
-        cerr << "Error: Could not open file " << filename << endl;
-        exit(1); // Exit if the file cannot be opened
+// How the covered span of each row of a triangle is found. Both backends find
+// exactly the same spans, so they draw the same pixels. Multisampled renders
+// always solve the edge functions, per sample.
+enum RasterBackend {
+    RASTER_EDGE,     // Solve the three edge functions of each row for its span (three divisions a row)
+    RASTER_SCANLINE, // Walk the active edges down the rows (an add and a compare per edge and row)
+    RASTER_AUTO      // Walk the edges of triangles with short spans, solve the others
+};
+
+// Per-triangle data computed once before any pixel is visited
+struct TriangleSetup {
+    Vertex a, b, c;                 // Triangle vertices in screen space
+    int colors[9];                  // RGB colors of a, b and c
+    Edge edges[3];                  // Edge functions of the covered triangle
+    int edgeTop[3], edgeBottom[3];  // Rows between the end points of each edge
+    long long area;                 // Twice the signed area of the covered triangle
+    int minX, maxX, minY, maxY;     // Bounding box clipped to the image
+    bool flat;                      // True when all three vertices share one color
+    bool translucent;               // Some vertex is not fully opaque
+    bool clip;                      // Crosses the guard band and must be clipped first
+    bool perspective;               // Colors are interpolated perspective-correctly
+    AttributePlane color[3];        // Red, green and blue (divided by z when perspective)
+    AttributePlane invZ;            // 1 / z, only used when perspective
+    AttributePlane opacity;         // Alpha (divided by z when perspective), only set when translucent
+    const Texture* texture;         // Texture replacing the vertex colors, or nullptr
+    TextureFilter filter;
+    int checker;                    // Squares per texture unit of a procedural checkerboard, or 0
+    AttributePlane texcoord[2];     // u and v (divided by z when perspective)
+    float lod;                      // Texture level of detail when it is constant over the triangle
+    AttributePlane depth;           // Screen-space depth
+    float minZ, maxZ;               // Depth range of the vertices
+    uint32_t faceIndex;             // Index of the face in the mesh, for the face-ID target
+    RasterBackend raster;           // How the spans of the rows are found
+};
+
+// Function to evaluate an attribute plane at pixel (x, y)
+double evaluatePlane(const AttributePlane& plane, const TriangleSetup& setup, int x, int y) {
+    return plane.atA + plane.dx * (static_cast<double>(x) - setup.a.x) + plane.dy * (static_cast<double>(y) - setup.a.y);
+}
+
+// Function to compute the plane through the values va, vb, vc at the vertices;
+// area is twice the signed area of the triangle
+AttributePlane makePlane(const Vertex& a, const Vertex& b, const Vertex& c, double area, double va, double vb, double vc) {
+    double dB = vb - va, dC = vc - va;
+    AttributePlane plane;
+    plane.atA = va;
+    plane.dx = (dB * (static_cast<double>(c.y) - a.y) - dC * (static_cast<double>(b.y) - a.y)) / area;
+    plane.dy = (dC * (static_cast<double>(b.x) - a.x) - dB * (static_cast<double>(c.x) - a.x)) / area;
+    return plane;
+}
+
+// Function to build the edge function of the directed edge p -> q
+Edge makeEdge(const Vertex& p, const Vertex& q) {
+    Edge e;
+    e.A = static_cast<long long>(p.y) - q.y;
+    e.B = static_cast<long long>(q.x) - p.x;
+    e.C = -(e.A * p.x + e.B * p.y);
+    return e;
+}
+
+// Which winding, as seen on screen with y pointing down, is culled at setup
+enum CullMode {
+    CULL_NONE,
+    CULL_CW,  // Cull clockwise triangles (positive signed area)
+    CULL_CCW  // Cull counter-clockwise triangles (negative signed area)
+};
+
+// Outcome of the triangle setup
+enum SetupResult {
+    TRIANGLE_VISIBLE,
+    CULLED_BACKFACE,   // Wrong winding for the cull mode
+    CULLED_DEGENERATE, // Zero area
+    CULLED_OFFSCREEN,  // Bounding box outside the image
+    CULLED_INVALID     // Vertex index out of range
+};
+
+// Number of triangles drawn and culled for each reason
+struct CullStats {
+    long long visible = 0, backface = 0, degenerate = 0, offscreen = 0, invalid = 0;
+
+    void count(SetupResult result) {
+        switch (result) {
+        case TRIANGLE_VISIBLE:  visible++; break;
+        case CULLED_BACKFACE:   backface++; break;
+        case CULLED_DEGENERATE: degenerate++; break;
+        case CULLED_OFFSCREEN:  offscreen++; break;
+        case CULLED_INVALID:    invalid++; break;
+        }
+    }
+
+    void add(const CullStats& other) {
+        visible += other.visible;
+        backface += other.backface;
+        degenerate += other.degenerate;
+        offscreen += other.offscreen;
+        invalid += other.invalid;
+    }
+};
+
+// Vertices at most this many pixels outside the image are rasterized directly;
+// this keeps every edge function product far inside 64-bit range
+const long long GUARD_BAND = 1 << 20;
+
+// Function to check whether a vertex lies inside the guard band around the image
+bool insideGuardBand(const Vertex& v, int width, int height) {
+    return v.x >= -GUARD_BAND && v.x < width + GUARD_BAND && v.y >= -GUARD_BAND && v.y < height + GUARD_BAND;
+}
+
+// Twice the signed area of triangle p0 p1 p2; exact for vertices inside the guard band
+long long signedArea(const Vertex& p0, const Vertex& p1, const Vertex& p2) {
+    return (static_cast<long long>(p1.x) - p0.x) * (static_cast<long long>(p2.y) - p0.y)
+         - (static_cast<long long>(p1.y) - p0.y) * (static_cast<long long>(p2.x) - p0.x);
+}
+
+// Function to set up the edge functions and image-clipped bounding box of the
+// triangle p0 p1 p2 (inside the guard band); returns false if it covers no pixel
+bool setupCoverage(int width, int height, const Vertex& p0, const Vertex& p1, const Vertex& p2, long long area, TriangleSetup& setup) {
+    if (area == 0) return false;
+    setup.area = area;
+    setup.edges[0] = makeEdge(p1, p2);
+    setup.edges[1] = makeEdge(p2, p0);
+    setup.edges[2] = makeEdge(p0, p1);
+    const Vertex* ends[3][2] = { { &p1, &p2 }, { &p2, &p0 }, { &p0, &p1 } };
+    for (int k = 0; k < 3; ++k) {
+        setup.edgeTop[k] = min(ends[k][0]->y, ends[k][1]->y);
+        setup.edgeBottom[k] = max(ends[k][0]->y, ends[k][1]->y);
+    }
+    if (area < 0) { // Flip clockwise triangles so the inside is always E >= 0
+        for (Edge& e : setup.edges) {
+            e.A = -e.A;
+            e.B = -e.B;
+            e.C = -e.C;
+        }
+    }
+
+    // Bounding box of the triangle, clipped to the image
+    setup.minX = max(0, min(p0.x, min(p1.x, p2.x)));
+    setup.maxX = min(width - 1, max(p0.x, max(p1.x, p2.x)));
+    setup.minY = max(0, min(p0.y, min(p1.y, p2.y)));
+    setup.maxY = min(height - 1, max(p0.y, max(p1.y, p2.y)));
+    return setup.minX <= setup.maxX && setup.minY <= setup.maxY;
+}
+
+// Options that change how triangles are set up
+struct RenderOptions {
+    CullMode cullMode = CULL_NONE;
+    bool perspective = false; // Treat z as view distance and interpolate colors perspective-correctly
+    const Texture* texture = nullptr; // Texture for meshes with texture coordinates
+    TextureFilter filter = FILTER_BILINEAR;
+    int checker = 0; // Squares per texture unit of a checkerboard on meshes with texture coordinates
+    RasterBackend raster = RASTER_AUTO;
+};
+
+// Function to check whether a face has a vertex that is not fully opaque
+bool isTranslucent(const Face& face) {
+    return (face.colors[0] & face.colors[1] & face.colors[2]) >> 24 != 0xFF;
+}
+
+// Function to count the faces of a mesh that are blended rather than drawn opaque
+uint32_t countTranslucentFaces(const MeshView& mesh) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) count += isTranslucent(mesh.faces[i]);
+    return count;
+}
+
+// Function to compute the triangle setup; anything but TRIANGLE_VISIBLE means nothing is drawn
+SetupResult setupTriangle(int width, int height, const RenderOptions& options, const MeshView& mesh, const Face& face, TriangleSetup& setup) {
+    // Faces of a mapped binary mesh have not been validated yet
+    if (face.v1 >= mesh.numVertices || face.v2 >= mesh.numVertices || face.v3 >= mesh.numVertices) return CULLED_INVALID;
+    setup.a = mesh.vertex(face.v1);
+    setup.b = mesh.vertex(face.v2);
+    setup.c = mesh.vertex(face.v3);
+    const Vertex& a = setup.a;
+    const Vertex& b = setup.b;
+    const Vertex& c = setup.c;
+    float w[3] = { 1, 1, 1 };
+    if (mesh.w) {
+        w[0] = mesh.w[face.v1];
+        w[1] = mesh.w[face.v2];
+        w[2] = mesh.w[face.v3];
+        // Triangles reaching in front of the camera's near plane are outside the view
+        if (!(min(w[0], min(w[1], w[2])) >= mesh.nearZ)) return CULLED_OFFSCREEN;
+    }
+
+    // Signed area decides the winding; degenerate triangles cover no pixel. It is
+    // exact inside the guard band and only used for its sign outside of it.
+    setup.clip = !insideGuardBand(a, width, height) || !insideGuardBand(b, width, height) || !insideGuardBand(c, width, height);
+    double area;
+    if (setup.clip) {
+        area = (static_cast<double>(b.x) - a.x) * (static_cast<double>(c.y) - a.y)
+             - (static_cast<double>(b.y) - a.y) * (static_cast<double>(c.x) - a.x);
+    } else {
+        area = static_cast<double>(signedArea(a, b, c));
+    }
+    if (area == 0) return CULLED_DEGENERATE;
+    if ((options.cullMode == CULL_CW && area > 0) || (options.cullMode == CULL_CCW && area < 0)) return CULLED_BACKFACE;
+
+    if (setup.clip) {
+        // Only the bounding box is needed to reject the triangle; edges are set up per clipped piece
+        if (max(a.x, max(b.x, c.x)) < 0 || min(a.x, min(b.x, c.x)) >= width ||
+            max(a.y, max(b.y, c.y)) < 0 || min(a.y, min(b.y, c.y)) >= height) {
+            return CULLED_OFFSCREEN;
+        }
+    } else if (!setupCoverage(width, height, a, b, c, signedArea(a, b, c), setup)) {
+        return CULLED_OFFSCREEN;
+    }
+
+    setup.raster = options.raster;
+
+    // Plane equation of the depth, so it can be stepped along a span
+    setup.depth = makePlane(a, b, c, area, a.z, b.z, c.z);
+    setup.minZ = min(a.z, min(b.z, c.z));
+    setup.maxZ = max(a.z, max(b.z, c.z));
+
+    // Constant-color faces can skip interpolation entirely
+    setup.texture = mesh.u && mesh.v ? options.texture : nullptr;
+    setup.filter = options.filter;
+    setup.checker = mesh.u && mesh.v ? options.checker : 0;
+    setup.flat = !setup.texture && !setup.checker && face.colors[0] == face.colors[1] && face.colors[0] == face.colors[2];
+    for (int k = 0; k < 3; ++k) {
+        RGBA8::unpack(face.colors[k], &setup.colors[3 * k]);
+    }
+    setup.translucent = isTranslucent(face);
+    if (setup.flat) {
+        if (setup.translucent) setup.opacity = AttributePlane{ double(face.colors[0] >> 24), 0, 0 };
+        return TRIANGLE_VISIBLE;
+    }
+
+    // Attribute planes; perspective-correct interpolation steps attribute / z and 1 / z
+    // linearly and divides per pixel, which needs every vertex in front of the viewer.
+    // Meshes projected by a camera always use it, with their view distance w.
+    if (!mesh.w && options.perspective && mesh.z && setup.minZ > 0) {
+        w[0] = a.z;
+        w[1] = b.z;
+        w[2] = c.z;
+    }
+    setup.perspective = mesh.w || (options.perspective && mesh.z && setup.minZ > 0);
+    double weight[3] = { 1, 1, 1 };
+    if (setup.perspective) {
+        weight[0] = 1.0 / w[0];
+        weight[1] = 1.0 / w[1];
+        weight[2] = 1.0 / w[2];
+        setup.invZ = makePlane(a, b, c, area, weight[0], weight[1], weight[2]);
+    }
+    if (setup.translucent) {
+        setup.opacity = makePlane(a, b, c, area, (face.colors[0] >> 24) * weight[0], (face.colors[1] >> 24) * weight[1],
+                                  (face.colors[2] >> 24) * weight[2]);
+    }
+    if (setup.texture || setup.checker) {
+        setup.texcoord[0] = makePlane(a, b, c, area, a.u * weight[0], b.u * weight[1], c.u * weight[2]);
+        setup.texcoord[1] = makePlane(a, b, c, area, a.v * weight[0], b.v * weight[1], c.v * weight[2]);
+    }
+    if (setup.texture) {
+        // Affine texture coordinates have constant derivatives, so one level of detail fits the whole triangle
+        setup.lod = setup.texture->levelOfDetail(setup.texcoord[0].dx, setup.texcoord[1].dx,
+                                                 setup.texcoord[0].dy, setup.texcoord[1].dy);
+        return TRIANGLE_VISIBLE;
+    }
+    for (int j = 0; j < 3; ++j) {
+        setup.color[j] = makePlane(a, b, c, area, setup.colors[j] * weight[0], setup.colors[3 + j] * weight[1],
+                                   setup.colors[6 + j] * weight[2]);
+    }
+    return TRIANGLE_VISIBLE;
+}
+
+// Function to clip triangle a b c against the guard band (Sutherland-Hodgman).
+// Returns the number of vertices of the clipped convex polygon (at most 7).
+int clipToGuardBand(const Vertex& a, const Vertex& b, const Vertex& c, int width, int height, Vertex* polygon) {
+    double px[7] = { double(a.x), double(b.x), double(c.x) }, py[7] = { double(a.y), double(b.y), double(c.y) };
+    int count = 3;
+    // Guard band sides as (axis, sign, limit): inside when sign * coordinate <= limit
+    const double limits[4][3] = {
+        { 0, -1, double(GUARD_BAND) }, { 0, 1, double(width - 1 + GUARD_BAND) },
+        { 1, -1, double(GUARD_BAND) }, { 1, 1, double(height - 1 + GUARD_BAND) },
+    };
+    for (const auto& side : limits) {
+        double qx[7], qy[7];
+        int kept = 0;
+        for (int i = 0; i < count; ++i) {
+            int j = (i + 1) % count;
+            double di = side[1] * (side[0] == 0 ? px[i] : py[i]) - side[2];
+            double dj = side[1] * (side[0] == 0 ? px[j] : py[j]) - side[2];
+            if (di <= 0) { qx[kept] = px[i]; qy[kept] = py[i]; ++kept; }
+            if ((di <= 0) != (dj <= 0)) { // Edge crosses the side: keep the intersection
+                double t = di / (di - dj);
+                qx[kept] = px[i] + t * (px[j] - px[i]);
+                qy[kept] = py[i] + t * (py[j] - py[i]);
+                ++kept;
+            }
+        }
+        count = kept;
+        copy(qx, qx + count, px);
+        copy(qy, qy + count, py);
+    }
+    for (int i = 0; i < count; ++i) {
+        polygon[i] = Vertex{ static_cast<int>(llround(px[i])), static_cast<int>(llround(py[i])), 0.0f, 0.0f, 0.0f };
+    }
+    return count;
+}
+
+// Function to narrow the span [left, right] to the x where a * x + rowValue >= 0;
+// returns false when no x of the row qualifies
+bool narrowSpan(long long a, long long rowValue, long long& left, long long& right) {
+    if (a > 0) {
+        left = max(left, ceilDiv(-rowValue, a));
+    } else if (a < 0) {
+        right = min(right, floorDiv(rowValue, -a));
+    } else if (rowValue < 0) {
+        return false; // Row lies entirely outside of a horizontal edge
+    }
+    return true;
+}
+
+// Function to find the covered pixels [x0, x1] of row y; returns false for an empty row
+bool computeSpan(const TriangleSetup& setup, int y, int& x0, int& x1) {
+    long long left = setup.minX, right = setup.maxX;
+    for (const Edge& e : setup.edges) {
+        if (!narrowSpan(e.A, e.B * y + e.C, left, right)) return false; // E(x, y) = A * x + (B * y + C)
+    }
+    if (left > right) return false;
+    x0 = static_cast<int>(left);
+    x1 = static_cast<int>(right);
+    return true;
+}
+
+// Triangles whose spans average fewer pixels than this are walked as scanlines by
+// RASTER_AUTO; wider ones spend so little of their time per row that solving
+// the edges is as fast and needs no setup
+const int SCANLINE_AUTO_SPAN = 16;
+
+// One non-horizontal edge on the active edge list of the scanline backend. The
+// bound it puts on the span of row y is floor(m(y) / den), with m linear in y;
+// the quotient and remainder of that division are stepped from row to row, so
+// walking the edge needs no division after its first row.
+struct WalkedEdge {
+    int bottom;      // Last row the edge crosses
+    bool left;       // Bounds the span on the left (the first x inside), else on the right
+    long long bound; // The bound at the current row
+    long long remainder, den, boundStep, remainderStep;
+
+    // Function to start walking edge e at row y
+    void start(const Edge& e, int y, int lastRow) {
+        bottom = lastRow;
+        left = e.A > 0;
+        // Left: ceil(-(B * y + C) / A), as narrowSpan; right: floor((B * y + C) / -A)
+        den = left ? e.A : -e.A;
+        long long m = left ? -(e.B * y + e.C) + e.A - 1 : e.B * y + e.C;
+        long long step = left ? -e.B : e.B;
+        bound = floorDiv(m, den);
+        remainder = m - bound * den;
+        boundStep = floorDiv(step, den);
+        remainderStep = step - boundStep * den;
+    }
+
+    void advance() {
+        bound += boundStep;
+        remainder += remainderStep;
+        if (remainder >= den) {
+            remainder -= den;
+            bound++;
+        }
+    }
+};
+
+// Finds the covered span of each row of a triangle with the triangle's backend.
+// Rows must be asked for in order from setup.minY, each one once.
+class RowSpans {
+public:
+    explicit RowSpans(const TriangleSetup& triangle) : setup(triangle) {
+        long long rows = setup.maxY - setup.minY + 1;
+        walk = setup.raster == RASTER_SCANLINE ||
+               (setup.raster == RASTER_AUTO && rows > 2 && llabs(setup.area) < 2 * SCANLINE_AUTO_SPAN * rows);
+        if (!walk) return;
+        // Edge table: the edges by first row. Horizontal edges bound only the rows,
+        // which the bounding box already does.
+        for (int k = 0; k < 3; ++k) {
+            if (setup.edges[k].A == 0 || setup.edgeBottom[k] < setup.minY) continue;
+            int i = tableSize++;
+            for (; i > 0 && setup.edgeTop[table[i - 1]] > setup.edgeTop[k]; --i) table[i] = table[i - 1];
+            table[i] = k;
+        }
+    }
+
+    // Function to find the covered pixels [x0, x1] of row y; returns false for an empty row
+    bool next(int y, int& x0, int& x1) {
+        if (!walk) return computeSpan(setup, y, x0, x1);
+        if (y >= nextChange) updateActive(y);
+
+        // Only the edges crossing a row bound its span
+        long long left = setup.minX, right = setup.maxX;
+        for (int i = 0; i < activeCount; ++i) {
+            WalkedEdge& e = active[i];
+            if (e.left) {
+                left = max(left, e.bound);
+            } else {
+                right = min(right, e.bound);
+            }
+            e.advance();
+        }
+        if (left > right) return false;
+        x0 = static_cast<int>(left);
+        x1 = static_cast<int>(right);
+        return true;
+    }
+
+private:
+    const TriangleSetup& setup;
+    bool walk;
+    int table[3];         // Edge table: indices of the edges to walk, by first row
+    int tableSize = 0, pending = 0;
+    WalkedEdge active[3]; // Active edge list
+    int activeCount = 0;
+    int nextChange = INT_MIN; // First row at which an edge joins or leaves the list
+
+    // Function to drop the edges that ended above row y and add those that reach it
+    void updateActive(int y) {
+        int kept = 0;
+        for (int i = 0; i < activeCount; ++i) {
+            if (active[i].bottom >= y) active[kept++] = active[i];
+        }
+        activeCount = kept;
+        for (; pending < tableSize && setup.edgeTop[table[pending]] <= y; ++pending) {
+            int k = table[pending];
+            active[activeCount++].start(setup.edges[k], y, setup.edgeBottom[k]);
+        }
+        nextChange = pending < tableSize ? setup.edgeTop[table[pending]] : INT_MAX;
+        for (int i = 0; i < activeCount; ++i) nextChange = min(nextChange, active[i].bottom + 1);
+    }
+};
+
+// Shaders compute the color of a pixel from its varyings: attribute planes of the
+// triangle stepped along each span. Every shader declares at compile time how many
+// varyings it reads (VARYINGS, the planes plane(0) to plane(VARYINGS - 1)) and
+// whether they are perspective-correct (PERSPECTIVE: the planes hold attribute / z
+// and 1 / z is stepped as one more varying). The raster loops are instantiated per
+// shader, which drawTriangle picks once per triangle, so shading is inlined into
+// them with no per-pixel dispatch.
+
+// Steps the varyings of a shader along a span: one add per varying and pixel
+template <typename Shader>
+struct SpanStepper {
+    static const int COUNT = Shader::VARYINGS + (Shader::PERSPECTIVE ? 1 : 0);
+    float value[COUNT + 1], step[COUNT + 1]; // The varyings, then 1 / z when perspective
+
+    SpanStepper(const Shader& shader, const TriangleSetup& setup, int x, int y) {
+        if constexpr (Shader::VARYINGS > 0) {
+            for (int j = 0; j < Shader::VARYINGS; ++j) {
+                value[j] = static_cast<float>(evaluatePlane(shader.plane(j), setup, x, y));
+                step[j] = static_cast<float>(shader.plane(j).dx);
+            }
+        }
+        if (Shader::PERSPECTIVE) {
+            value[Shader::VARYINGS] = static_cast<float>(evaluatePlane(setup.invZ, setup, x, y));
+            step[Shader::VARYINGS] = static_cast<float>(setup.invZ.dx);
+        }
+    }
+
+    // Factor that turns the varyings back into attributes: z when perspective, else 1
+    float z() const { return Shader::PERSPECTIVE ? 1.0f / value[Shader::VARYINGS] : 1.0f; }
+
+    // Color of the shader at the current pixel
+    template <typename Format>
+    typename Format::Pixel shade(const Shader& shader) const {
+        return shader.template shade<Format>(value, z());
+    }
+
+    void advance() {
+        for (int j = 0; j < COUNT; ++j) value[j] += step[j];
+    }
+};
+
+// One color for the whole face: no varyings
+struct FlatShader {
+    static const int VARYINGS = 0;
+    static const bool PERSPECTIVE = false;
+    int rgb[3];
+
+    explicit FlatShader(const TriangleSetup& setup) : rgb{ setup.colors[0], setup.colors[1], setup.colors[2] } {}
+
+    template <typename Format>
+    typename Format::Pixel shade(const float*, float) const { return Format::pack(rgb[0], rgb[1], rgb[2]); }
+};
+
+// Vertex colors interpolated over the face, truncated like the barycentric
+// interpolation they replace
+template <bool Perspective>
+struct GouraudShader {
+    static const int VARYINGS = 3;
+    static const bool PERSPECTIVE = Perspective;
+    const TriangleSetup& setup;
+
+    explicit GouraudShader(const TriangleSetup& triangle) : setup(triangle) {}
+
+    const AttributePlane& plane(int j) const { return setup.color[j]; }
+
+    template <typename Format>
+    typename Format::Pixel shade(const float* value, float z) const {
+        return Format::pack(static_cast<int>(value[0] * z), static_cast<int>(value[1] * z), static_cast<int>(value[2] * z));
+    }
+};
+
+// Texture sampled with a fixed filter at the interpolated texture coordinates
+template <TextureFilter Filter, bool Perspective>
+struct TextureShader {
+    static const int VARYINGS = 2;
+    static const bool PERSPECTIVE = Perspective;
+    const TriangleSetup& setup;
+
+    explicit TextureShader(const TriangleSetup& triangle) : setup(triangle) {}
+
+    const AttributePlane& plane(int j) const { return setup.texcoord[j]; }
+
+    template <typename Format>
+    typename Format::Pixel shade(const float* value, float z) const {
+        float u = value[0] * z, v = value[1] * z;
+        TexelColor texel = setup.texture->template sample<Filter>(u, v, Perspective ? perspectiveLod(u, v, z) : setup.lod);
+        return Format::pack(static_cast<int>(texel.r + 0.5f), static_cast<int>(texel.g + 0.5f), static_cast<int>(texel.b + 0.5f));
+    }
+
+    // Level of detail under perspective, from the derivatives of u = (u / z) / (1 / z)
+    float perspectiveLod(float u, float v, float z) const {
+        double dudx = (setup.texcoord[0].dx - u * setup.invZ.dx) * z, dvdx = (setup.texcoord[1].dx - v * setup.invZ.dx) * z;
+        double dudy = (setup.texcoord[0].dy - u * setup.invZ.dy) * z, dvdy = (setup.texcoord[1].dy - v * setup.invZ.dy) * z;
+        return setup.texture->levelOfDetail(dudx, dvdx, dudy, dvdy);
+    }
+};
+
+// Procedural checkerboard in texture space: the vertex colors on the light
+// squares and a quarter of them on the dark ones, setup.checker squares per unit
+template <bool Perspective>
+struct CheckerShader {
+    static const int VARYINGS = 5;
+    static const bool PERSPECTIVE = Perspective;
+    const TriangleSetup& setup;
+
+    explicit CheckerShader(const TriangleSetup& triangle) : setup(triangle) {}
+
+    const AttributePlane& plane(int j) const { return j < 3 ? setup.color[j] : setup.texcoord[j - 3]; }
+
+    template <typename Format>
+    typename Format::Pixel shade(const float* value, float z) const {
+        int square = static_cast<int>(floor(value[3] * z * setup.checker)) + static_cast<int>(floor(value[4] * z * setup.checker));
+        int shift = (square & 1) * 2;
+        return Format::pack(static_cast<int>(value[0] * z) >> shift, static_cast<int>(value[1] * z) >> shift,
+                            static_cast<int>(value[2] * z) >> shift);
+    }
+};
+
+// Counters and timings of an instrumented render (--stats)
+struct RenderStats {
+    long long boxPixels = 0;     // Pixels in the bounding boxes of the drawn triangles
+    long long testedPixels = 0;  // Pixels inside the triangles, which reach the depth test
+    long long writtenPixels = 0; // Pixels shaded and stored
+    Framebuffer<Count32> overdraw; // Number of times each pixel was shaded
+    double parseMs = 0, transformMs = 0, setupMs = 0, rasterMs = 0, writeMs = 0;
+
+    // Function to count the pixels [x0, x1] of row y as shaded
+    void shade(int y, int x0, int x1) {
+        uint32_t* row = overdraw.row(y);
+        for (int x = x0; x <= x1; ++x) row[x]++;
+        writtenPixels += x1 - x0 + 1;
+    }
+};
+
+// Extra render targets written in the same pass as the image (--id-target and
+// --bary-target). The depth target is the depth buffer itself.
+enum RenderTarget {
+    TARGET_FACE_ID = 1,    // Index of the face that produced each pixel
+    TARGET_BARYCENTRIC = 2 // Barycentric weights of the pixel in that face
+};
+
+struct RenderTargets {
+    int enabled = 0; // RenderTarget flags
+    Framebuffer<FaceId32> faceIds;
+    Framebuffer<Barycentric16x2> barycentrics;
+
+    // Function to size the enabled targets like the image and mark every pixel empty
+    void reset(int width, int height) {
+        if (enabled & TARGET_FACE_ID) {
+            faceIds.resize(width, height);
+            faceIds.clear(NO_FACE);
+        }
+        if (enabled & TARGET_BARYCENTRIC) {
+            barycentrics.resize(width, height);
+            barycentrics.clear(NO_FACE);
+        }
     }
+};
 
-    string line;
-    while (getline(file, line)) { // Read the file line by line
-        if (line.empty() || line[0] == '#') continue; // Skip comments and empty lines
+// Writes the targets in Targets for the pixels of one triangle. Targets is a
+// template parameter, so renders without extra targets do no work for them.
+template <int Targets>
+struct TargetWriter {
+    RenderTargets* targets;
+    const TriangleSetup& setup;
+    AttributePlane weights[2]; // Barycentric weights of vertices b and c
+
+    TargetWriter(RenderTargets* renderTargets, const TriangleSetup& triangle) : targets(renderTargets), setup(triangle) {
+        if (Targets & TARGET_BARYCENTRIC) {
+            // Weights over the whole triangle, which clipped pieces share
+            const Vertex& a = setup.a;
+            const Vertex& b = setup.b;
+            const Vertex& c = setup.c;
+            double area = (static_cast<double>(b.x) - a.x) * (static_cast<double>(c.y) - a.y)
+                        - (static_cast<double>(b.y) - a.y) * (static_cast<double>(c.x) - a.x);
+            weights[0] = makePlane(a, b, c, area, 0, 1, 0);
+            weights[1] = makePlane(a, b, c, area, 0, 0, 1);
+        }
+    }
+
+    // Function to record pixel (x, y) as drawn by this triangle
+    void store(int x, int y) {
+        if (Targets & TARGET_FACE_ID) targets->faceIds.row(y)[x] = setup.faceIndex;
+        if (Targets & TARGET_BARYCENTRIC) {
+            double w1 = min(max(evaluatePlane(weights[0], setup, x, y), 0.0), 1.0);
+            double w2 = min(max(evaluatePlane(weights[1], setup, x, y), 0.0), 1.0);
+            targets->barycentrics.row(y)[x] = static_cast<uint32_t>(w1 * 65535 + 0.5) | static_cast<uint32_t>(w2 * 65535 + 0.5) << 16;
+        }
+    }
+
+    void storeSpan(int y, int x0, int x1) {
+        for (int x = x0; x <= x1; ++x) store(x, y);
+    }
+};
+
+// Function to render a triangle that lies in front of everything drawn before it (painter's order).
+// Instrumented renders also count the pixels they touch into stats; the Targets
+// enabled are written to targets.
+template <typename Format, typename Shader, bool Instrumented, int Targets>
+void renderTriangleOver(Framebuffer<Format>& image, const TriangleSetup& setup, RenderStats* stats, RenderTargets* targets) {
+    Shader shader(setup);
+    TargetWriter<Targets> targetWriter(targets, setup);
+    // Walk the triangle one horizontal span at a time
+    RowSpans spans(setup);
+    for (int y = setup.minY; y <= setup.maxY; ++y) {
+        int x0, x1;
+        if (!spans.next(y, x0, x1)) continue;
+        if (Instrumented) {
+            stats->testedPixels += x1 - x0 + 1;
+            stats->shade(y, x0, x1);
+        }
+        if (Targets) targetWriter.storeSpan(y, x0, x1);
 
-        // Read image size (width and height)
-        if (width == 0 && height == 0) {
-            stringstream ss(line);
-            ss >> width >> height; // Extract width and height
+        SpanStepper<Shader> varyings(shader, setup, x0, y);
+        // Shaders without varyings color a whole span at once
+        if (Shader::VARYINGS == 0) {
+            image.fillSpan(y, x0, x1, varyings.template shade<Format>(shader));
             continue;
         }
 
-        // Read vertex list
-        if (vertices == nullptr) {
-            stringstream ss(line);
-            ss >> numVertices; // Number of vertices
-            vertices = new Vertex[numVertices]; // Allocate memory for vertices
-            for (int i = 0; i < numVertices; ++i) {
-                getline(file, line);
-                stringstream ss(line);
-                ss >> vertices[i].x >> vertices[i].y; // Read vertex coordinates
+        typename Format::Pixel* row = image.row(y);
+        for (int x = x0; x <= x1; ++x, varyings.advance()) {
+            row[x] = varyings.template shade<Format>(shader); // Set the pixel color in the image
+        }
+    }
+}
+
+// Function to render a triangle with depth testing, one 8x8 depth tile at a time.
+// Tiles whose stored depths are all in front of the triangle are skipped whole.
+template <typename Format, typename Shader, bool Instrumented, int Targets>
+void renderTriangleDepth(Framebuffer<Format>& image, DepthBuffer& depth, const TriangleSetup& setup, RenderStats* stats,
+                         RenderTargets* targets) {
+    if (depth.occluded(setup.minX, setup.minY, setup.maxX, setup.maxY, setup.minZ)) {
+        depth.trianglesRejected++;
+        return;
+    }
+    Shader shader(setup);
+    TargetWriter<Targets> targetWriter(targets, setup);
+    RowSpans spans(setup);
+
+    // Process one band of tile rows at a time, computing its spans once
+    for (int bandY = setup.minY & ~(DEPTH_TILE_SIZE - 1); bandY <= setup.maxY; bandY += DEPTH_TILE_SIZE) {
+        int y0 = max(bandY, setup.minY), y1 = min(bandY + DEPTH_TILE_SIZE - 1, setup.maxY);
+        int spanX0[DEPTH_TILE_SIZE], spanX1[DEPTH_TILE_SIZE];
+        int bandX0 = setup.maxX + 1, bandX1 = setup.minX - 1;
+        for (int y = y0; y <= y1; ++y) {
+            int& x0 = spanX0[y - bandY];
+            int& x1 = spanX1[y - bandY];
+            if (!spans.next(y, x0, x1)) {
+                x0 = 1;
+                x1 = 0; // Empty span
+                continue;
+            }
+            bandX0 = min(bandX0, x0);
+            bandX1 = max(bandX1, x1);
+        }
+        if (bandX0 > bandX1) continue;
+
+        int ty = bandY >> DEPTH_TILE_SHIFT;
+        for (int tx = bandX0 >> DEPTH_TILE_SHIFT; tx <= (bandX1 >> DEPTH_TILE_SHIFT); ++tx) {
+            int tile = depth.tileIndex(tx, ty);
+            if (setup.minZ >= depth.tileMax[tile]) { // Everything in this tile is already closer
+                depth.tilesRejected++;
+                continue;
+            }
+            bool inFront = setup.maxZ < depth.tileMin[tile]; // Every fragment passes, skip the test
+            int tileX0 = tx << DEPTH_TILE_SHIFT, tileX1 = tileX0 + DEPTH_TILE_SIZE - 1;
+
+            bool written = false;
+            for (int y = y0; y <= y1; ++y) {
+                int x0 = max(spanX0[y - bandY], tileX0), x1 = min(spanX1[y - bandY], tileX1);
+                if (x0 > x1) continue;
+                float* depthRow = depth.depth.row(y);
+                typename Format::Pixel* row = image.row(y);
+                double z = evaluatePlane(setup.depth, setup, x0, y);
+                if (Instrumented) stats->testedPixels += x1 - x0 + 1;
+                SpanStepper<Shader> varyings(shader, setup, x0, y);
+                for (int x = x0; x <= x1; ++x, z += setup.depth.dx, varyings.advance()) {
+                    float fragmentZ = static_cast<float>(z);
+                    if (inFront || fragmentZ < depthRow[x]) {
+                        depthRow[x] = fragmentZ;
+                        row[x] = varyings.template shade<Format>(shader);
+                        written = true;
+                        if (Instrumented) stats->shade(y, x, x);
+                        if (Targets) targetWriter.store(x, y);
+                    }
+                }
+            }
+            if (written) depth.updateTile(tx, ty);
+        }
+    }
+}
+
+// Per-triangle constants of the multisample coverage test. Scaled by MSAA_SUBPIXEL,
+// the edge function of edge e at sample s of pixel (x, y) is exactly
+// a[e] * x + rowValue(e, y) + offset[e][s], with rowValue(e, y) = MSAA_SUBPIXEL * (B * y + C).
+struct SampleCoverage {
+    int count;
+    long long a[3];
+    long long offset[3][MSAA_MAX_SAMPLES];
+    long long minOffset[3], maxOffset[3]; // Offsets of the samples least and most inside each edge
+
+    SampleCoverage(const TriangleSetup& setup, const SamplePattern& pattern) : count(pattern.count) {
+        for (int e = 0; e < 3; ++e) {
+            const Edge& edge = setup.edges[e];
+            a[e] = edge.A * MSAA_SUBPIXEL;
+            minOffset[e] = LLONG_MAX;
+            maxOffset[e] = LLONG_MIN;
+            for (int s = 0; s < count; ++s) {
+                offset[e][s] = edge.A * pattern.offset[s][0] + edge.B * pattern.offset[s][1];
+                minOffset[e] = min(minOffset[e], offset[e][s]);
+                maxOffset[e] = max(maxOffset[e], offset[e][s]);
+            }
+        }
+    }
+};
+
+// Coverage of one row of a triangle for multisampling
+struct SampleSpans {
+    const SampleCoverage* coverage;
+    long long rowValue[3];
+    int outerX0, outerX1; // Pixels that may have a sample covered
+    int innerX0, innerX1; // Pixels with every sample covered (empty when innerX0 > innerX1)
+
+    // Coverage mask of pixel x
+    uint32_t mask(int x) const {
+        if (x >= innerX0 && x <= innerX1) return (1u << coverage->count) - 1;
+        long long value[3];
+        for (int e = 0; e < 3; ++e) value[e] = coverage->a[e] * x + rowValue[e];
+        uint32_t m = 0;
+        for (int s = 0; s < coverage->count; ++s) {
+            bool inside = (value[0] + coverage->offset[0][s] >= 0) & (value[1] + coverage->offset[1][s] >= 0) &
+                          (value[2] + coverage->offset[2][s] >= 0);
+            m |= static_cast<uint32_t>(inside) << s;
+        }
+        return m;
+    }
+};
+
+// Function to compute the coverage of row y from the samples least and most inside
+// each edge, with as many divisions as a single-sample span; returns false when no
+// sample of the row is covered
+bool computeSampleSpans(const TriangleSetup& setup, const SampleCoverage& coverage, int y, SampleSpans& spans) {
+    spans.coverage = &coverage;
+    long long outerX0 = setup.minX, outerX1 = setup.maxX;
+    long long innerX0 = setup.minX, innerX1 = setup.maxX;
+    for (int e = 0; e < 3; ++e) {
+        const Edge& edge = setup.edges[e];
+        long long rowValue = (edge.B * y + edge.C) * MSAA_SUBPIXEL;
+        spans.rowValue[e] = rowValue;
+        if (!narrowSpan(coverage.a[e], rowValue + coverage.maxOffset[e], outerX0, outerX1)) return false;
+        if (!narrowSpan(coverage.a[e], rowValue + coverage.minOffset[e], innerX0, innerX1)) {
+            innerX0 = setup.maxX + 1; // No pixel has every sample inside this edge
+        }
+    }
+    if (outerX0 > outerX1) return false;
+    spans.outerX0 = static_cast<int>(outerX0);
+    spans.outerX1 = static_cast<int>(outerX1);
+    if (innerX0 > innerX1) { // No fully covered pixel: keep the empty span inside the row
+        innerX0 = outerX1 + 1;
+        innerX1 = outerX1;
+    }
+    spans.innerX0 = static_cast<int>(innerX0);
+    spans.innerX1 = static_cast<int>(innerX1);
+    return true;
+}
+
+// Function to render a triangle with multisampling in painter's order. Pixels with
+// every sample covered are written to the image like renderTriangleOver does; only
+// the partly covered pixels at the ends of each span write individual samples. Each
+// pixel is shaded once, at its center, whatever its coverage.
+template <typename Format, typename Shader>
+void renderTriangleMultisampleOver(Framebuffer<Format>& image, MultisampleBuffer& msaa, const TriangleSetup& setup) {
+    Shader shader(setup);
+    SampleCoverage coverage(setup, samplePattern(msaa.samples));
+    for (int y = setup.minY; y <= setup.maxY; ++y) {
+        SampleSpans spans;
+        if (!computeSampleSpans(setup, coverage, y, spans)) continue;
+        if (spans.innerX0 <= spans.innerX1) msaa.setUniform(y, spans.innerX0, spans.innerX1);
+
+        SpanStepper<Shader> varyings(shader, setup, spans.outerX0, y);
+        if (Shader::VARYINGS == 0) {
+            typename Format::Pixel color = varyings.template shade<Format>(shader);
+            for (int x = spans.outerX0; x <= spans.outerX1; ++x) {
+                if (x == spans.innerX0) { // Fully covered pixels are filled at once
+                    image.fillSpan(y, spans.innerX0, spans.innerX1, color);
+                    x = spans.innerX1;
+                    continue;
+                }
+                uint32_t mask = spans.mask(x);
+                if (mask) msaa.write(image, x, y, mask, color);
             }
             continue;
         }
 
-        // Read face list
-        if (faces == nullptr) {
-            stringstream ss(line);
-            ss >> numFaces; // Number of faces (triangles)
-            faces = new Face[numFaces]; // Allocate memory for faces
-            for (int i = 0; i < numFaces; ++i) {
-                getline(file, line);
-                stringstream ss(line);
-                ss >> faces[i].v1 >> faces[i].v2 >> faces[i].v3; // Read vertex indices
-                for (int j = 0; j < 9; ++j) {
-                    ss >> faces[i].colors[j]; // Read RGB colors for each vertex
+        typename Format::Pixel* row = image.row(y);
+        for (int x = spans.outerX0; x <= spans.outerX1; ++x, varyings.advance()) {
+            if (x >= spans.innerX0 && x <= spans.innerX1) {
+                row[x] = varyings.template shade<Format>(shader); // Fully covered pixel
+                continue;
+            }
+            uint32_t mask = spans.mask(x);
+            if (mask) msaa.write(image, x, y, mask, varyings.template shade<Format>(shader));
+        }
+    }
+}
+
+// Function to depth test the samples in mask of pixel (x, y) for a fragment with depth
+// z at the pixel center, and store the depths that pass. The samples of a uniform
+// pixel get their depths from its center depth and surface slopes, and the pixel is
+// only expanded when some but not all samples pass. Returns the mask of the passing
+// samples.
+template <int Samples>
+uint32_t testSampleDepths(MultisampleBuffer& msaa, float* depthRow, int x, int y, uint32_t mask, float z,
+                          const float* sampleDz, float dzdx, float dzdy) {
+    size_t pixel = msaa.pixelIndex(x, y);
+    bool expanded = msaa.expanded[pixel];
+    float uniformDepth[Samples];
+    float* sampleDepth = expanded ? msaa.depthSamples(msaa.acquire(pixel)) : uniformDepth; // Tested in place
+    if (!expanded) msaa.uniformSampleDepths(x, y, depthRow[x], uniformDepth);
+    uint32_t passed = 0;
+    float farthest = -numeric_limits<float>::infinity();
+    for (int s = 0; s < Samples; ++s) {
+        float fragmentZ = z + sampleDz[s];
+        bool pass = ((mask >> s) & 1) & (fragmentZ < sampleDepth[s]);
+        sampleDepth[s] = pass ? fragmentZ : sampleDepth[s];
+        passed |= static_cast<uint32_t>(pass) << s;
+        farthest = max(farthest, sampleDepth[s]);
+    }
+    if (passed == msaa.fullMask) {
+        depthRow[x] = z; // Uniform again
+        msaa.setSlopes(x, y, dzdx, dzdy);
+    } else if (passed) {
+        if (!expanded) std::copy(uniformDepth, uniformDepth + Samples, msaa.depthSamples(msaa.acquire(pixel)));
+        depthRow[x] = farthest; // Keeps the hierarchical tiles conservative
+    }
+    return passed;
+}
+
+// Function to render a triangle with multisampling and depth testing, one 8x8 depth
+// tile at a time like renderTriangleDepth. Fully covered uniform pixels whose stored
+// depth range lies wholly behind or in front of the fragment's take the single-sample
+// depth test; the others, on triangle edges or where the fragment's surface crosses
+// the stored one, test every covered sample. A pixel is shaded once when any of its
+// samples passes. The sample count is a template parameter so the test of all
+// samples of a pixel compiles to straight-line code.
+template <typename Format, typename Shader, int Samples>
+void renderTriangleMultisampleDepth(Framebuffer<Format>& image, MultisampleBuffer& msaa, DepthBuffer& depth, const TriangleSetup& setup) {
+    // Stored samples may lie up to the tile spread behind their pixel's depth
+    if (depth.occluded(setup.minX, setup.minY, setup.maxX, setup.maxY, setup.minZ - msaa.maxSpread)) {
+        depth.trianglesRejected++;
+        return;
+    }
+    Shader shader(setup);
+    const SamplePattern& pattern = samplePattern(Samples);
+    SampleCoverage coverage(setup, pattern);
+    const float dzdx = static_cast<float>(setup.depth.dx), dzdy = static_cast<float>(setup.depth.dy);
+    float sampleDz[Samples]; // Depth of each sample relative to the pixel center
+    sampleDepthOffsets(pattern, dzdx, dzdy, sampleDz);
+    float spread = 0; // How far the fragment's samples lie from its center depth
+    for (float dz : sampleDz) spread = max(spread, fabs(dz));
+
+    for (int bandY = setup.minY & ~(DEPTH_TILE_SIZE - 1); bandY <= setup.maxY; bandY += DEPTH_TILE_SIZE) {
+        int y0 = max(bandY, setup.minY), y1 = min(bandY + DEPTH_TILE_SIZE - 1, setup.maxY);
+        SampleSpans spans[DEPTH_TILE_SIZE];
+        int bandX0 = setup.maxX + 1, bandX1 = setup.minX - 1;
+        for (int y = y0; y <= y1; ++y) {
+            SampleSpans& row = spans[y - bandY];
+            if (!computeSampleSpans(setup, coverage, y, row)) {
+                row.outerX0 = 1;
+                row.outerX1 = 0; // Empty span
+                continue;
+            }
+            bandX0 = min(bandX0, row.outerX0);
+            bandX1 = max(bandX1, row.outerX1);
+        }
+        if (bandX0 > bandX1) continue;
+
+        int ty = bandY >> DEPTH_TILE_SHIFT;
+        for (int tx = bandX0 >> DEPTH_TILE_SHIFT; tx <= (bandX1 >> DEPTH_TILE_SHIFT); ++tx) {
+            int tile = depth.tileIndex(tx, ty);
+            const float tileSpread = msaa.tileSpread[tile];
+            if (setup.minZ >= depth.tileMax[tile] + tileSpread) { // Everything in this tile is already closer
+                depth.tilesRejected++;
+                continue;
+            }
+            bool inFront = setup.maxZ < depth.tileMin[tile] - tileSpread; // Uniform pixels pass, skip their test
+            // (expanded pixels keep their farthest sample in the tile, so they are always tested)
+            int tileX0 = tx << DEPTH_TILE_SHIFT, tileX1 = tileX0 + DEPTH_TILE_SIZE - 1;
+
+            bool written = false;
+            for (int y = y0; y <= y1; ++y) {
+                const SampleSpans& row = spans[y - bandY];
+                int x0 = max(row.outerX0, tileX0), x1 = min(row.outerX1, tileX1);
+                if (x0 > x1) continue;
+                float* depthRow = depth.depth.row(y);
+                typename Format::Pixel* pixels = image.row(y);
+                const uint8_t* expanded = &msaa.expanded[msaa.pixelIndex(0, y)];
+                double z = evaluatePlane(setup.depth, setup, x0, y);
+                SpanStepper<Shader> varyings(shader, setup, x0, y);
+                for (int x = x0; x <= x1; ++x, z += setup.depth.dx, varyings.advance()) {
+                    float fragmentZ = static_cast<float>(z);
+                    uint32_t mask;
+                    if (x >= row.innerX0 && x <= row.innerX1 && !expanded[x]) {
+                        if (inFront || fragmentZ + spread < depthRow[x] - tileSpread) { // Every sample passes
+                            depthRow[x] = fragmentZ;
+                            msaa.setSlopes(x, y, dzdx, dzdy);
+                            pixels[x] = varyings.template shade<Format>(shader);
+                            written = true;
+                            continue;
+                        }
+                        if (fragmentZ - spread >= depthRow[x] + tileSpread) continue; // Every sample fails
+                        mask = msaa.fullMask; // The surfaces may cross inside the pixel
+                    } else {
+                        mask = row.mask(x);
+                        if (mask == 0) continue;
+                    }
+                    uint32_t passed = testSampleDepths<Samples>(msaa, depthRow, x, y, mask, fragmentZ, sampleDz, dzdx, dzdy);
+                    if (passed == 0) continue;
+                    msaa.write(image, x, y, passed, varyings.template shade<Format>(shader));
+                    written = true;
                 }
             }
+            if (written) {
+                depth.updateTile(tx, ty);
+                msaa.widenTileSpread(tile, spread);
+            }
+        }
+    }
+}
+
+// Settings and counters shared by all triangles of one render
+struct RenderContext {
+    RenderOptions options;
+    bool depthTest = false; // Depth test against depth, otherwise draw in painter's order
+    DepthBuffer depth;
+    CullStats culled;
+    int firstRow = 0, lastRow = INT_MAX; // Image rows drawn; a band when several contexts share one image
+    RenderStats* stats = nullptr; // Counters of an instrumented render, or nullptr
+    RenderTargets* targets = nullptr; // Extra targets written with the image, or nullptr
+    int samples = 1;        // Samples per pixel; anti-aliased through msaa when more than one
+    MultisampleBuffer msaa; // Samples of an anti-aliased render
+    int threads = 1;        // Threads blending the translucent faces of a whole-image render
+    RenderTargets opaqueFaces; // Opaque face at each pixel, when blending over a mesh without depth
+    uint32_t translucentFaces = 0; // Faces blended by the last whole-image render
+    long long fragments = 0, fragmentsDropped = 0; // Their fragments, and those dropped from full lists
+};
+
+// Function to decide whether a face can cover rows of the context's band, so faces
+// outside it are skipped before setup. Every face is counted in the statistics of
+// exactly one band: the one holding its top row, clamped to the image.
+bool faceInBand(const RenderContext& context, const MeshView& mesh, const Face& face, bool& counted) {
+    if (face.v1 >= mesh.numVertices || face.v2 >= mesh.numVertices || face.v3 >= mesh.numVertices) {
+        counted = context.firstRow == 0;
+        return counted; // Set up only to be counted as invalid
+    }
+    int minY = min(mesh.y[face.v1], min(mesh.y[face.v2], mesh.y[face.v3]));
+    int maxY = max(mesh.y[face.v1], max(mesh.y[face.v2], mesh.y[face.v3]));
+    int top = min(max(minY, 0), mesh.height - 1);
+    counted = top >= context.firstRow && top <= context.lastRow;
+    return counted || (maxY >= context.firstRow && minY <= context.lastRow);
+}
+
+// Function to rasterize a set-up triangle with the given shader, writing the targets in Targets
+template <typename Format, typename Shader, int Targets>
+void drawToTargets(Framebuffer<Format>& image, RenderContext& context, const TriangleSetup& setup) {
+    if (context.depthTest) {
+        renderTriangleDepth<Format, Shader, false, Targets>(image, context.depth, setup, nullptr, context.targets);
+    } else {
+        renderTriangleOver<Format, Shader, false, Targets>(image, setup, nullptr, context.targets);
+    }
+}
+
+// Function to rasterize a set-up triangle with the context's depth mode and the given shader
+template <typename Format, typename Shader>
+void drawShaded(Framebuffer<Format>& image, RenderContext& context, const TriangleSetup& setup) {
+    if (context.targets) {
+        int enabled = context.targets->enabled;
+        if (enabled == (TARGET_FACE_ID | TARGET_BARYCENTRIC)) {
+            drawToTargets<Format, Shader, TARGET_FACE_ID | TARGET_BARYCENTRIC>(image, context, setup);
+        } else if (enabled == TARGET_FACE_ID) {
+            drawToTargets<Format, Shader, TARGET_FACE_ID>(image, context, setup);
+        } else {
+            drawToTargets<Format, Shader, TARGET_BARYCENTRIC>(image, context, setup);
+        }
+        return;
+    }
+    if (context.samples > 1) {
+        if (context.depthTest && context.samples == 8) {
+            renderTriangleMultisampleDepth<Format, Shader, 8>(image, context.msaa, context.depth, setup);
+        } else if (context.depthTest) {
+            renderTriangleMultisampleDepth<Format, Shader, 4>(image, context.msaa, context.depth, setup);
+        } else {
+            renderTriangleMultisampleOver<Format, Shader>(image, context.msaa, setup);
+        }
+        return;
+    }
+    if (context.stats) {
+        context.stats->boxPixels += static_cast<long long>(setup.maxX - setup.minX + 1) * (setup.maxY - setup.minY + 1);
+        if (context.depthTest) {
+            renderTriangleDepth<Format, Shader, true, 0>(image, context.depth, setup, context.stats, nullptr);
+        } else {
+            renderTriangleOver<Format, Shader, true, 0>(image, setup, context.stats, nullptr);
+        }
+    } else if (context.depthTest) {
+        renderTriangleDepth<Format, Shader, false, 0>(image, context.depth, setup, nullptr, nullptr);
+    } else {
+        renderTriangleOver<Format, Shader, false, 0>(image, setup, nullptr, nullptr);
+    }
+}
+
+// Function to rasterize a textured triangle with a shader for its filter
+template <typename Format, bool Perspective>
+void drawTextured(Framebuffer<Format>& image, RenderContext& context, const TriangleSetup& setup) {
+    if (setup.filter == FILTER_NEAREST) {
+        drawShaded<Format, TextureShader<FILTER_NEAREST, Perspective>>(image, context, setup);
+    } else if (setup.filter == FILTER_BILINEAR) {
+        drawShaded<Format, TextureShader<FILTER_BILINEAR, Perspective>>(image, context, setup);
+    } else {
+        drawShaded<Format, TextureShader<FILTER_TRILINEAR, Perspective>>(image, context, setup);
+    }
+}
+
+// Function to rasterize a set-up triangle, picking the shader for its attributes
+template <typename Format>
+void drawTriangle(Framebuffer<Format>& image, RenderContext& context, const TriangleSetup& setup) {
+    if (setup.minY < context.firstRow || setup.maxY > context.lastRow) {
+        // Only the rows inside the band are drawn
+        TriangleSetup band = setup;
+        band.minY = max(setup.minY, context.firstRow);
+        band.maxY = min(setup.maxY, context.lastRow);
+        if (band.minY <= band.maxY) drawTriangle(image, context, band);
+        return;
+    }
+    if (setup.flat) {
+        drawShaded<Format, FlatShader>(image, context, setup);
+    } else if (setup.texture) {
+        if (setup.perspective) {
+            drawTextured<Format, true>(image, context, setup);
+        } else {
+            drawTextured<Format, false>(image, context, setup);
+        }
+    } else if (setup.checker) {
+        if (setup.perspective) {
+            drawShaded<Format, CheckerShader<true>>(image, context, setup);
+        } else {
+            drawShaded<Format, CheckerShader<false>>(image, context, setup);
+        }
+    } else if (setup.perspective) {
+        drawShaded<Format, GouraudShader<true>>(image, context, setup);
+    } else {
+        drawShaded<Format, GouraudShader<false>>(image, context, setup);
+    }
+}
+
+// Function to draw a set-up triangle. Triangles crossing the guard band are drawn as
+// a fan of clipped pieces; each piece gets its own edges but keeps the attributes of
+// the whole triangle.
+template <typename Format>
+void rasterizeTriangle(Framebuffer<Format>& image, RenderContext& context, const MeshView& mesh, const TriangleSetup& setup) {
+    if (!setup.clip) {
+        drawTriangle(image, context, setup);
+        return;
+    }
+
+    Vertex polygon[7];
+    int count = clipToGuardBand(setup.a, setup.b, setup.c, mesh.width, mesh.height, polygon);
+    for (int i = 1; i + 1 < count; ++i) {
+        TriangleSetup piece = setup;
+        long long area = signedArea(polygon[0], polygon[i], polygon[i + 1]);
+        if (setupCoverage(mesh.width, mesh.height, polygon[0], polygon[i], polygon[i + 1], area, piece)) {
+            drawTriangle(image, context, piece);
+        }
+    }
+}
+
+// Milliseconds elapsed since the given time point
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Function to render face number faceIndex on the image. Setup works in the coordinates
+// of the whole image described by the mesh, of which the framebuffer may hold only a band.
+template <typename Format>
+void renderTriangle(Framebuffer<Format>& image, RenderContext& context, const MeshView& mesh, const Face& face, uint32_t faceIndex) {
+    bool counted = true;
+    if (context.lastRow < mesh.height - 1 || context.firstRow > 0) {
+        if (!faceInBand(context, mesh, face, counted)) return;
+    }
+
+    TriangleSetup setup;
+    setup.faceIndex = faceIndex;
+    if (context.stats) {
+        // Time setup and rasterization of every triangle separately
+        auto start = chrono::steady_clock::now();
+        SetupResult result = setupTriangle(mesh.width, mesh.height, context.options, mesh, face, setup);
+        context.stats->setupMs += elapsedMs(start);
+        if (counted) context.culled.count(result);
+        if (result != TRIANGLE_VISIBLE) return;
+        start = chrono::steady_clock::now();
+        rasterizeTriangle(image, context, mesh, setup);
+        context.stats->rasterMs += elapsedMs(start);
+        return;
+    }
+
+    SetupResult result = setupTriangle(mesh.width, mesh.height, context.options, mesh, face, setup);
+    if (counted) context.culled.count(result);
+    if (result != TRIANGLE_VISIBLE) return;
+    rasterizeTriangle(image, context, mesh, setup);
+}
+
+// Function to store the fragments of a set-up triangle, already clipped to the
+// tile, in the tile's lists. Fragments behind the opaque surface of their pixel
+// are discarded: those not in front of its depth for meshes with depth, those
+// of faces before the opaque face drawn there in painter's order otherwise.
+template <typename Shader>
+void storeFragments(FragmentTile& tile, const RenderContext& context, const TriangleSetup& setup) {
+    Shader shader(setup);
+    RowSpans spans(setup);
+    const bool depthTest = context.depthTest;
+    const uint32_t order = depthTest ? setup.faceIndex : ~setup.faceIndex; // Later faces are nearer in painter's order
+    for (int y = setup.minY; y <= setup.maxY; ++y) {
+        int x0, x1;
+        if (!spans.next(y, x0, x1)) continue;
+        const float* depthRow = depthTest ? context.depth.depth.row(y) : nullptr;
+        const uint32_t* faceRow = depthTest ? nullptr : context.opaqueFaces.faceIds.row(y);
+        double z = evaluatePlane(setup.depth, setup, x0, y);
+        float alpha = static_cast<float>(evaluatePlane(setup.opacity, setup, x0, y));
+        SpanStepper<Shader> varyings(shader, setup, x0, y);
+        for (int x = x0; x <= x1; ++x, z += setup.depth.dx, alpha += static_cast<float>(setup.opacity.dx), varyings.advance()) {
+            Fragment fragment;
+            fragment.z = depthTest ? static_cast<float>(z) : 0.0f;
+            if (depthTest ? !(fragment.z < depthRow[x]) : faceRow[x] != NO_FACE && faceRow[x] > setup.faceIndex) continue;
+            int opacity = min(static_cast<int>(alpha * varyings.z()), 255);
+            if (opacity <= 0) continue; // Fully transparent
+            fragment.order = order;
+            fragment.color = (varyings.template shade<RGBA8>(shader) & 0xFFFFFFu) | static_cast<uint32_t>(opacity) << 24;
+            tile.insert(x, y, fragment);
         }
     }
 }
 
-// Function to compute barycentric coordinates for a point (x, y) with respect to a triangle (a, b, c)
-void computeBarycentricCoordinates(int x, int y, const Vertex& a, const Vertex& b, const Vertex& c, double& alpha, double& beta, double& gamma) {
-    // Compute the area of the main triangle (abc)
-    double areaABC = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+// Function to store the fragments of a set-up triangle inside the tile, picking
+// the shader for its attributes as drawTriangle does
+void storeTileFragments(FragmentTile& tile, const RenderContext& context, const TriangleSetup& setup) {
+    TriangleSetup clipped = setup;
+    clipped.minX = max(setup.minX, tile.x0);
+    clipped.maxX = min(setup.maxX, tile.x0 + FRAGMENT_TILE_SIZE - 1);
+    clipped.minY = max(setup.minY, tile.y0);
+    clipped.maxY = min(setup.maxY, tile.y0 + FRAGMENT_TILE_SIZE - 1);
+    if (clipped.minX > clipped.maxX || clipped.minY > clipped.maxY) return;
+    if (clipped.flat) {
+        storeFragments<FlatShader>(tile, context, clipped);
+    } else if (clipped.texture && clipped.perspective) {
+        if (clipped.filter == FILTER_NEAREST) {
+            storeFragments<TextureShader<FILTER_NEAREST, true>>(tile, context, clipped);
+        } else if (clipped.filter == FILTER_BILINEAR) {
+            storeFragments<TextureShader<FILTER_BILINEAR, true>>(tile, context, clipped);
+        } else {
+            storeFragments<TextureShader<FILTER_TRILINEAR, true>>(tile, context, clipped);
+        }
+    } else if (clipped.texture) {
+        if (clipped.filter == FILTER_NEAREST) {
+            storeFragments<TextureShader<FILTER_NEAREST, false>>(tile, context, clipped);
+        } else if (clipped.filter == FILTER_BILINEAR) {
+            storeFragments<TextureShader<FILTER_BILINEAR, false>>(tile, context, clipped);
+        } else {
+            storeFragments<TextureShader<FILTER_TRILINEAR, false>>(tile, context, clipped);
+        }
+    } else if (clipped.checker) {
+        if (clipped.perspective) {
+            storeFragments<CheckerShader<true>>(tile, context, clipped);
+        } else {
+            storeFragments<CheckerShader<false>>(tile, context, clipped);
+        }
+    } else if (clipped.perspective) {
+        storeFragments<GouraudShader<true>>(tile, context, clipped);
+    } else {
+        storeFragments<GouraudShader<false>>(tile, context, clipped);
+    }
+}
+
+// Function to blend the translucent faces of a mesh over its opaque render. The
+// faces are sorted into tiles of FRAGMENT_TILE_SIZE pixels; each thread takes the
+// next tile, collects its fragments in its own tile buffer and resolves them into
+// the image, so the result depends neither on the order of the faces nor on the
+// number of threads.
+template <typename Format>
+void blendTranslucentFaces(Framebuffer<Format>& image, RenderContext& context, const MeshView& mesh) {
+    const int tilesX = (mesh.width + FRAGMENT_TILE_SIZE - 1) >> FRAGMENT_TILE_SHIFT;
+    const int tilesY = (mesh.height + FRAGMENT_TILE_SIZE - 1) >> FRAGMENT_TILE_SHIFT;
+    const int tiles = tilesX * tilesY;
 
-    // Compute the area of sub-triangles (pbc, apc, abp)
-    double areaPBC = (b.x - x) * (c.y - y) - (b.y - y) * (c.x - x);
-    double areaAPC = (x - a.x) * (c.y - a.y) - (y - a.y) * (c.x - a.x);
-    double areaABP = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+    // Set up every translucent face once, to count it and find the tiles it overlaps
+    vector<uint32_t> visible;
+    vector<int> boxes; // First and last tile column and row of each visible face
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+        const Face& face = mesh.faces[i];
+        if (!isTranslucent(face)) continue;
+        TriangleSetup setup;
+        SetupResult result = setupTriangle(mesh.width, mesh.height, context.options, mesh, face, setup);
+        context.culled.count(result);
+        if (result != TRIANGLE_VISIBLE) continue;
+        auto tileOf = [](int v, int size) { return min(max(v, 0), size - 1) >> FRAGMENT_TILE_SHIFT; };
+        visible.push_back(i);
+        boxes.push_back(tileOf(min(setup.a.x, min(setup.b.x, setup.c.x)), mesh.width));
+        boxes.push_back(tileOf(max(setup.a.x, max(setup.b.x, setup.c.x)), mesh.width));
+        boxes.push_back(tileOf(min(setup.a.y, min(setup.b.y, setup.c.y)), mesh.height));
+        boxes.push_back(tileOf(max(setup.a.y, max(setup.b.y, setup.c.y)), mesh.height));
+    }
+
+    // Count the faces of each tile, then place them in mesh order (a counting sort, as in binFacesToBands)
+    vector<uint32_t> tileStart(static_cast<size_t>(tiles) + 1, 0);
+    auto forEachTile = [&](size_t v, auto&& visit) {
+        const int* box = &boxes[4 * v];
+        for (int ty = box[2]; ty <= box[3]; ++ty) {
+            for (int tx = box[0]; tx <= box[1]; ++tx) visit(ty * tilesX + tx);
+        }
+    };
+    for (size_t v = 0; v < visible.size(); ++v) forEachTile(v, [&](int t) { tileStart[t + 1]++; });
+    for (int t = 0; t < tiles; ++t) tileStart[t + 1] += tileStart[t];
+    vector<uint32_t> faces(tileStart[tiles]);
+    vector<uint32_t> next(tileStart.begin(), tileStart.end() - 1);
+    for (size_t v = 0; v < visible.size(); ++v) forEachTile(v, [&](int t) { faces[next[t]++] = visible[v]; });
 
-    // Compute barycentric coordinates
-    beta = areaAPC / areaABC;
-    gamma = areaABP / areaABC;
-    alpha = 1 - beta - gamma;
+    atomic<int> nextTile(0);
+    atomic<long long> fragments(0), dropped(0);
+    auto worker = [&] {
+        FragmentTile tile;
+        for (int t = nextTile++; t < tiles; t = nextTile++) {
+            if (tileStart[t] == tileStart[t + 1]) continue;
+            tile.reset((t % tilesX) << FRAGMENT_TILE_SHIFT, (t / tilesX) << FRAGMENT_TILE_SHIFT);
+            for (uint32_t i = tileStart[t]; i < tileStart[t + 1]; ++i) {
+                TriangleSetup setup;
+                setup.faceIndex = faces[i];
+                setupTriangle(mesh.width, mesh.height, context.options, mesh, mesh.faces[faces[i]], setup);
+                if (!setup.clip) {
+                    storeTileFragments(tile, context, setup);
+                    continue;
+                }
+                // Pieces clipped to the guard band, as in rasterizeTriangle
+                Vertex polygon[7];
+                int count = clipToGuardBand(setup.a, setup.b, setup.c, mesh.width, mesh.height, polygon);
+                for (int k = 1; k + 1 < count; ++k) {
+                    TriangleSetup piece = setup;
+                    long long area = signedArea(polygon[0], polygon[k], polygon[k + 1]);
+                    if (setupCoverage(mesh.width, mesh.height, polygon[0], polygon[k], polygon[k + 1], area, piece)) {
+                        storeTileFragments(tile, context, piece);
+                    }
+                }
+            }
+            tile.resolve(image);
+        }
+        fragments += tile.stored;
+        dropped += tile.dropped;
+    };
+    vector<thread> workers;
+    for (int t = 1; t < min(context.threads, tiles); ++t) workers.emplace_back(worker);
+    worker();
+    for (thread& t : workers) t.join();
+    context.fragments = fragments;
+    context.fragmentsDropped = dropped;
 }
 
-// Function to interpolate color using barycentric coordinates
-void interpolateColor(double alpha, double beta, double gamma, const int* colorA, const int* colorB, const int* colorC, int* result) {
-    // Interpolate RGB values using barycentric coordinates
-    result[0] = static_cast<int>(alpha * colorA[0] + beta * colorB[0] + gamma * colorC[0]); // Red
-    result[1] = static_cast<int>(alpha * colorA[1] + beta * colorB[1] + gamma * colorC[1]); // Green
-    result[2] = static_cast<int>(alpha * colorA[2] + beta * colorB[2] + gamma * colorC[2]); // Blue
+// Function to clear the image and render every face into it; meshes with
+// per-vertex depth are depth tested, others are drawn in painter's order.
+// Anti-aliased renders resolve the pixels expanded into samples at the end.
+// Translucent faces are left out of that pass and blended over it afterwards.
+template <typename Format>
+void renderMesh(Framebuffer<Format>& image, RenderContext& context, const MeshView& mesh) {
+    image.clear(Format::pack(0, 0, 0)); // Initialize to black
+    context.culled = CullStats();
+    context.depthTest = mesh.z != nullptr;
+    if (context.samples > 1) {
+        context.msaa.resize(image.width, image.height, context.samples, context.depthTest);
+        context.msaa.clear();
+    }
+    if (context.depthTest) {
+        context.depth.resize(image.width, image.height);
+        context.depth.clear();
+    }
+    if (context.stats) {
+        RenderStats& stats = *context.stats;
+        stats.boxPixels = stats.testedPixels = stats.writtenPixels = 0;
+        stats.setupMs = stats.rasterMs = 0;
+        stats.overdraw.resize(image.width, image.height);
+        stats.overdraw.clear(0);
+    }
+    if (context.targets) context.targets->reset(image.width, image.height);
+    context.translucentFaces = countTranslucentFaces(mesh);
+    context.fragments = context.fragmentsDropped = 0;
+    if (context.translucentFaces == 0) {
+        for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+            renderTriangle(image, context, mesh, mesh.faces[i], i);
+        }
+        if (context.samples > 1) context.msaa.resolve(image);
+        return;
+    }
+
+    // Without depth, the opaque face at each pixel decides which translucent faces lie over it
+    RenderTargets* targets = context.targets;
+    if (!context.depthTest) {
+        context.opaqueFaces.enabled = TARGET_FACE_ID;
+        context.opaqueFaces.reset(image.width, image.height);
+        context.targets = &context.opaqueFaces;
+    }
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+        if (!isTranslucent(mesh.faces[i])) renderTriangle(image, context, mesh, mesh.faces[i], i);
+    }
+    context.targets = targets;
+    blendTranslucentFaces(image, context, mesh);
 }
 
-// Function to render a triangle on the image
-void renderTriangle(int* image, int width, int height, const Vertex* vertices, const Face& face) {
-    // Get the vertices of the triangle
-    Vertex a = vertices[face.v1 - 1];
-    Vertex b = vertices[face.v2 - 1];
-    Vertex c = vertices[face.v3 - 1];
+// Function to print the report of an instrumented render of numFaces faces
+void printRenderStats(const RenderContext& context, uint32_t numFaces, double inputMegabytes) {
+    const RenderStats& stats = *context.stats;
+    const CullStats& culled = context.culled;
+    uint32_t maxOverdraw = 0;
+    long long coveredPixels = 0;
+    for (uint32_t count : stats.overdraw.pixels) {
+        maxOverdraw = max(maxOverdraw, count);
+        coveredPixels += count > 0;
+    }
+    auto percent = [](long long part, long long whole) { return whole > 0 ? 100.0 * part / whole : 0.0; };
+
+    cout << "Statistics (setup and raster include the cost of timing every triangle):" << endl;
+    cout << "  parse     " << stats.parseMs << " ms  (" << inputMegabytes / (stats.parseMs / 1000) << " MB/s)" << endl;
+    if (stats.transformMs > 0) cout << "  transform " << stats.transformMs << " ms" << endl;
+    cout << "  setup     " << stats.setupMs << " ms" << endl;
+    cout << "  raster    " << stats.rasterMs << " ms" << endl;
+    cout << "  write     " << stats.writeMs << " ms" << endl;
+    cout << "  triangles " << numFaces << " at " << numFaces / ((stats.setupMs + stats.rasterMs) / 1000) / 1e6
+         << " million/s; " << culled.visible << " visible, culled " << culled.backface << " back-facing, "
+         << culled.degenerate << " degenerate, " << culled.offscreen << " off-screen, " << culled.invalid << " invalid" << endl;
+    cout << "  pixels    " << stats.boxPixels << " in bounding boxes, " << stats.testedPixels << " tested ("
+         << percent(stats.testedPixels, stats.boxPixels) << "% coverage), " << stats.writtenPixels << " written ("
+         << percent(stats.writtenPixels, stats.testedPixels) << "% of tested)" << endl;
+    cout << "  overdraw  " << (coveredPixels > 0 ? static_cast<double>(stats.writtenPixels) / coveredPixels : 0.0)
+         << " average over " << coveredPixels << " covered pixels, " << maxOverdraw << " max" << endl;
+    if (context.depthTest) {
+        cout << "  hierarchical Z rejected " << context.depth.trianglesRejected << " triangles and "
+             << context.depth.tilesRejected << " tiles" << endl;
+    }
+}
+
+// Faces per batch and batches in flight between the parser and the raster threads
+const uint32_t STREAM_BATCH_FACES = 4096;
+const int STREAM_QUEUE_BATCHES = 16;
 
-    // Get the colors for each vertex
-    const int* colorA = &face.colors[0]; // RGB for vertex A
-    const int* colorB = &face.colors[3]; // RGB for vertex B
-    const int* colorC = &face.colors[6]; // RGB for vertex C
+// Function to render a mesh file while it is still being read. A parser thread
+// reads the faces in batches into a bounded queue; each raster thread draws every
+// batch, in file order, into its own band of image rows, so the result matches
+// renderMesh while parsing and rasterization overlap.
+template <typename Format>
+bool renderMeshStream(const string& filename, Framebuffer<Format>& image, RenderContext& context, int threads, string& error) {
+    MeshFaceStream stream;
+    if (!stream.open(filename, error)) return false;
+    const MeshView& mesh = stream.view;
+    if (stream.alpha || (mesh.faces && countTranslucentFaces(mesh) > 0)) {
+        error = filename + ": faces with opacity are blended only by whole-image renders, not --stream";
+        return false;
+    }
+    image.resize(mesh.width, mesh.height);
+    image.clear(Format::pack(0, 0, 0)); // Initialize to black
+    context.culled = CullStats();
+    context.depthTest = mesh.z != nullptr;
 
-    // Iterate over all pixels in the image
-    for (int x = 0; x < width; ++x) {
-        for (int y = 0; y < height; ++y) {
-            double alpha, beta, gamma;
-            // Compute barycentric coordinates for the current pixel
-            computeBarycentricCoordinates(x, y, a, b, c, alpha, beta, gamma);
+    // Split the rows into bands made of whole depth tiles, one per raster thread
+    int bandRows = (mesh.height + threads - 1) / threads;
+    bandRows = (bandRows + DEPTH_TILE_SIZE - 1) & ~(DEPTH_TILE_SIZE - 1);
+    int bands = (mesh.height + bandRows - 1) / bandRows;
+    vector<RenderContext> workers(static_cast<size_t>(bands), context);
+    for (int i = 0; i < bands; ++i) {
+        RenderContext& worker = workers[i];
+        worker.firstRow = i * bandRows;
+        worker.lastRow = min(mesh.height, worker.firstRow + bandRows) - 1;
+        if (worker.depthTest) {
+            worker.depth.resize(mesh.width, worker.lastRow - worker.firstRow + 1, worker.firstRow);
+            worker.depth.clear();
+        }
+    }
 
-            // If the pixel lies inside the triangle, interpolate its color
-            if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-                int color[3];
-                interpolateColor(alpha, beta, gamma, colorA, colorB, colorC, color);
-                // Set the pixel color in the image
-                int index = (y * width + x) * 3; // Calculate the index for the pixel
-                image[index + 0] = color[0]; // Red
-                image[index + 1] = color[1]; // Green
-                image[index + 2] = color[2]; // Blue
+    FaceBatchQueue queue(STREAM_QUEUE_BATCHES, bands, STREAM_BATCH_FACES);
+    bool parsed = true;
+    thread parser([&] {
+        for (;;) {
+            FaceBatch& batch = queue.beginWrite();
+            if (!stream.read(batch.faces.data(), STREAM_BATCH_FACES, batch.count, error)) {
+                parsed = false;
+                break;
+            }
+            if (batch.count == 0) break;
+            queue.endWrite();
+        }
+        queue.close();
+    });
+    vector<thread> rasterizers;
+    for (int i = 0; i < bands; ++i) {
+        rasterizers.emplace_back([&, i] {
+            uint32_t firstFace = 0; // Index of the first face of the batch
+            while (const FaceBatch* batch = queue.beginRead(i)) {
+                for (uint32_t f = 0; f < batch->count; ++f) {
+                    renderTriangle(image, workers[i], mesh, batch->faces[f], firstFace + f);
+                }
+                firstFace += batch->count;
+                queue.endRead(i);
             }
+        });
+    }
+    parser.join();
+    for (thread& rasterizer : rasterizers) rasterizer.join();
+    if (!parsed) {
+        error = filename + ": " + error;
+        return false;
+    }
+
+    // Combine the counters of all bands
+    context.depth.trianglesRejected = context.depth.tilesRejected = 0;
+    for (const RenderContext& worker : workers) {
+        context.culled.add(worker.culled);
+        context.depth.trianglesRejected += worker.depth.trianglesRejected;
+        context.depth.tilesRejected += worker.depth.tilesRejected;
+    }
+    return true;
+}
+
+// Function to sort the faces into bands of bandRows image rows. Face indices of band b
+// end up in faces[bandStart[b]] to faces[bandStart[b + 1] - 1], in mesh order; a face
+// is listed in every band its rows overlap (clamped to the image, so off-screen and
+// invalid faces are still seen, and counted, by one band).
+void binFacesToBands(const MeshView& mesh, int bandRows, vector<uint32_t>& bandStart, vector<uint32_t>& faces) {
+    int bands = (mesh.height + bandRows - 1) / bandRows;
+    auto bandRange = [&](const Face& face, int& first, int& last) {
+        if (face.v1 >= mesh.numVertices || face.v2 >= mesh.numVertices || face.v3 >= mesh.numVertices) {
+            first = last = 0;
+            return;
         }
+        int minY = min(mesh.y[face.v1], min(mesh.y[face.v2], mesh.y[face.v3]));
+        int maxY = max(mesh.y[face.v1], max(mesh.y[face.v2], mesh.y[face.v3]));
+        first = min(max(minY, 0), mesh.height - 1) / bandRows;
+        last = min(max(maxY, 0), mesh.height - 1) / bandRows;
+    };
+
+    // Count the faces of each band, then place them (a counting sort, so no list is resized)
+    bandStart.assign(static_cast<size_t>(bands) + 1, 0);
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+        int first, last;
+        bandRange(mesh.faces[i], first, last);
+        for (int b = first; b <= last; ++b) bandStart[b + 1]++;
+    }
+    for (int b = 0; b < bands; ++b) bandStart[b + 1] += bandStart[b];
+    faces.resize(bandStart[bands]);
+    vector<uint32_t> next(bandStart.begin(), bandStart.end() - 1);
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+        int first, last;
+        bandRange(mesh.faces[i], first, last);
+        for (int b = first; b <= last; ++b) faces[next[b]++] = i;
     }
 }
 
-// Function to write the image to a .ppm file
-void writePPMFile(const string& filename, int* image, int width, int height) {
-    ofstream file(filename); // Open the output file
+// Function to render a mesh one band of rows at a time into a small buffer and
+// append every finished band to the output file, so the whole image never has
+// to fit in memory; the result is the same as rendering it in one piece
+template <typename Format>
+bool renderMeshBands(const MeshView& mesh, RenderContext& context, int bandRows, const string& filename, PPMEncoding encoding) {
+    ofstream file(filename, ios::binary); // Open the output file
     if (!file.is_open()) {
         cerr << "Error: Could not create file " << filename << endl;
-        exit(1); // Exit if the file cannot be created
+        return false;
     }
+    writePPMHeader(file, mesh.width, mesh.height, encoding);
 
-    // Write the PPM header
-    file << "P3" << endl; // PPM format (text-based)
-    file << width << " " << height << endl; // Image dimensions
-    file << "255" << endl; // Maximum color value
+    bandRows = (bandRows + DEPTH_TILE_SIZE - 1) & ~(DEPTH_TILE_SIZE - 1); // Whole depth tiles
+    vector<uint32_t> bandStart, faces;
+    binFacesToBands(mesh, bandRows, bandStart, faces);
 
-    // Write the pixel data
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            int index = (y * width + x) * 3; // Calculate the index for the pixel
-            file << image[index + 0] << " " 
-                 << image[index + 1] << " " 
-                 << image[index + 2] << " "; // RGB values
+    context.culled = CullStats();
+    context.depthTest = mesh.z != nullptr;
+    long long trianglesRejected = 0, tilesRejected = 0;
+    Framebuffer<Format> band;
+    for (int b = 0; b + 1 < static_cast<int>(bandStart.size()); ++b) {
+        context.firstRow = b * bandRows;
+        context.lastRow = min(mesh.height, context.firstRow + bandRows) - 1;
+        int rows = context.lastRow - context.firstRow + 1;
+        band.resize(mesh.width, rows, context.firstRow);
+        band.clear(Format::pack(0, 0, 0)); // Initialize to black
+        if (context.depthTest) {
+            context.depth.resize(mesh.width, rows, context.firstRow);
+            context.depth.clear();
+        }
+        for (uint32_t i = bandStart[b]; i < bandStart[b + 1]; ++i) {
+            renderTriangle(band, context, mesh, mesh.faces[faces[i]], faces[i]);
+        }
+        trianglesRejected += context.depth.trianglesRejected;
+        tilesRejected += context.depth.tilesRejected;
+
+        if (!writePPMRows(file, band, context.firstRow, context.lastRow + 1, encoding)) {
+            cerr << "Error: Could not write pixel data to " << filename << endl;
+            return false;
         }
-        file << endl;
     }
+    context.firstRow = 0;
+    context.lastRow = INT_MAX;
+    context.depth.trianglesRejected = trianglesRejected;
+    context.depth.tilesRejected = tilesRejected;
+    return true;
+}
+
+// Function to name the file of one animation frame: "out.ppm" becomes "out_0007.ppm"
+string frameFileName(const string& outputFile, size_t frame) {
+    char number[24];
+    snprintf(number, sizeof(number), "_%04zu", frame);
+    size_t dot = outputFile.find_last_of('.');
+    if (dot == string::npos || outputFile.find_first_of("/\\", dot) != string::npos) return outputFile + number + ".ppm";
+    return outputFile.substr(0, dot) + number + outputFile.substr(dot);
 }
 
-int main() {
-    // Prompt the user for the input file name
-    string inputFile;
-    cout << "Enter the input file name: ";
-    cin >> inputFile;
+// Function to render one frame per model matrix, viewed through camera. The
+// vertices are converted once and shared; each thread takes the next frame and
+// renders it with its own framebuffer, depth buffer and screen-space vertices,
+// all reused from frame to frame, so a frame costs only its transform, raster and
+// encoding. Frames are written to numbered files, or, when outputFile is "-",
+// in order to stdout as a stream of concatenated images.
+template <typename Format>
+bool renderAnimation(const MeshView& mesh, const RenderContext& context, const vector<Mat4>& frames, const Camera& camera,
+                     int threads, const string& outputFile, PPMEncoding encoding) {
+    VertexBuffer model;
+    model.assign(mesh);
+    bool toStdout = outputFile == "-";
+    atomic<size_t> nextFrame(0);
+    atomic<bool> failed(false);
+    size_t framesWritten = 0; // Frames already on stdout
+    mutex outputMutex;
+    condition_variable frameWritten;
+
+    auto renderFrames = [&] {
+        Framebuffer<Format> image(mesh.width, mesh.height);
+        RenderContext frameContext = context;
+        frameContext.threads = 1; // Frames are already rendered in parallel
+        ScreenVertices screen;
+        for (size_t frame = nextFrame++; frame < frames.size() && !failed; frame = nextFrame++) {
+            MeshView view = projectMesh(mesh, model, frames[frame], camera, screen);
+            renderMesh(image, frameContext, view);
+            if (!toStdout) {
+                if (!writePPMFile(frameFileName(outputFile, frame), image, encoding)) failed = true;
+                continue;
+            }
+
+            // Wait for the previous frame to be written, then append this one unless
+            // a frame has failed: the stream must stop at the last complete frame
+            unique_lock<mutex> lock(outputMutex);
+            frameWritten.wait(lock, [&] { return framesWritten == frame || failed; });
+            if (failed) break;
+            writePPMHeader(cout, image.width, image.height, encoding);
+            if (!writePPMRows(cout, image, 0, image.height, encoding)) {
+                cerr << "Error: Could not write frame " << frame << " to stdout" << endl;
+                failed = true;
+            }
+            framesWritten++;
+            frameWritten.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < threads; ++i) workers.emplace_back(renderFrames);
+    for (thread& worker : workers) worker.join();
+    cout.flush();
+    return !failed;
+}
+
+// Function to check that a render can blend the translucent faces of a mesh:
+// only single-sampled whole-image renders without statistics or extra targets
+// can. Prints an error otherwise.
+bool canBlendTranslucentFaces(const MeshView& mesh, const RenderContext& context, bool bands) {
+    if (!(bands || context.samples > 1 || context.stats || context.targets) || countTranslucentFaces(mesh) == 0) return true;
+    cerr << "Error: meshes with translucent faces cannot be rendered with --band, --msaa, --stats or render targets" << endl;
+    return false;
+}
+
+// Function to time every stage over several runs and print the average per run
+template <typename Format>
+void runBenchmark(const string& inputFile, const string& outputFile, RenderContext& context, int runs, int streamThreads,
+                  const Camera* camera, int objImageSize) {
+    double parseMs = 0, transformMs = 0, streamMs = 0, writeP6Ms = 0, writeP3Ms = 0;
+    const RasterBackend backends[3] = { RASTER_EDGE, RASTER_SCANLINE, RASTER_AUTO };
+    const char* backendNames[3] = { "edge", "scanline", "auto" };
+    double renderMs[3] = { 0, 0, 0 };
+    const RasterBackend selected = context.options.raster;
+    TransformStage transform;
+    for (int run = 0; run < runs; ++run) {
+        LoadedMesh mesh;
+        auto start = chrono::steady_clock::now();
+        readInputFile(inputFile, mesh, objImageSize);
+        parseMs += elapsedMs(start);
+        if (!canBlendTranslucentFaces(mesh.view, context, false)) exit(1);
+
+        MeshView view = mesh.view;
+        if (camera) {
+            transform.load(view);
+            start = chrono::steady_clock::now();
+            view = transform.project(mesh.view, Mat4::identity(), *camera);
+            transformMs += elapsedMs(start);
+        }
+
+        // Render the same scene with each backend, the selected one last so its image is written
+        Framebuffer<Format> image(view.width, view.height);
+        for (int b = 0; b < 3; ++b) {
+            int backend = (b + 1 + selected) % 3;
+            context.options.raster = backends[backend];
+            start = chrono::steady_clock::now();
+            renderMesh(image, context, view);
+            renderMs[backend] += elapsedMs(start);
+        }
+
+        if (streamThreads > 0) {
+            string error;
+            start = chrono::steady_clock::now();
+            if (!renderMeshStream(inputFile, image, context, streamThreads, error)) {
+                cerr << "Error: " << error << endl;
+                exit(1);
+            }
+            streamMs += elapsedMs(start);
+        }
+
+        start = chrono::steady_clock::now();
+        writePPMFile(outputFile, image, PPM_BINARY);
+        writeP6Ms += elapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        writePPMFile(outputFile, image, PPM_ASCII);
+        writeP3Ms += elapsedMs(start);
+    }
+
+    MappedFile file;
+    double megabytes = file.open(inputFile) ? file.size() / 1e6 : 0;
+
+    cout << "Benchmark over " << runs << " runs (average ms per run):" << endl;
+    cout << "  load      " << parseMs / runs << "  (" << megabytes * runs / (parseMs / 1000) << " MB/s)" << endl;
+    if (camera) cout << "  transform " << transformMs / runs << endl;
+    for (int b = 0; b < 3; ++b) {
+        cout << "  render    " << renderMs[b] / runs << "  (--raster " << backendNames[b]
+             << (backends[b] == selected ? ", selected)" : ")") << endl;
+    }
+    if (streamThreads > 0) {
+        cout << "  stream    " << streamMs / runs << "  (load and render overlapped, " << streamThreads
+             << " raster threads)" << endl;
+    }
+    cout << "  write P6  " << writeP6Ms / runs << endl;
+    cout << "  write P3  " << writeP3Ms / runs << endl;
+    const CullStats& culled = context.culled;
+    cout << "  triangles " << culled.visible << " visible, culled " << culled.backface << " back-facing, "
+         << culled.degenerate << " degenerate, " << culled.offscreen << " off-screen, "
+         << culled.invalid << " invalid per run" << endl;
+    if (context.depthTest) {
+        cout << "  hierarchical Z rejected " << context.depth.trianglesRejected << " triangles and "
+             << context.depth.tilesRejected << " tiles per run" << endl;
+    }
+}
+
+// Function to print the face drawn at each pixel listed in a file, one line per
+// point with the face index (from 0, as in the face-ID target) and the barycentric
+// weights of its vertices there. The results go to stdout, so the timings go
+// to stderr.
+bool pickFaces(const MeshView& mesh, CullMode cullMode, const string& pointsFile, int threads) {
+    vector<PickPoint> points;
+    string error;
+    if (!readPickPoints(pointsFile, points, error)) {
+        cerr << "Error: " << error << endl;
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    PickIndex index;
+    index.build(mesh, cullMode == CULL_CW ? PICK_CULL_CW : cullMode == CULL_CCW ? PICK_CULL_CCW : PICK_CULL_NONE);
+    double buildMs = elapsedMs(start);
+    start = chrono::steady_clock::now();
+    vector<PickHit> hits(points.size());
+    pickPoints(index, points.data(), points.size(), hits.data(), threads);
+    double queryMs = elapsedMs(start);
+
+    string out;
+    char line[128];
+    for (size_t i = 0; i < points.size(); ++i) {
+        const PickHit& hit = hits[i];
+        if (hit.face == PICK_NO_FACE) {
+            snprintf(line, sizeof(line), "%d %d -\n", points[i].x, points[i].y);
+        } else {
+            snprintf(line, sizeof(line), "%d %d %u %.6f %.6f %.6f\n", points[i].x, points[i].y, hit.face, hit.weights[0],
+                     hit.weights[1], hit.weights[2]);
+        }
+        out += line;
+    }
+    cout << out << flush;
+    cerr << "Indexed " << mesh.numFaces << " faces in " << index.cells() << " cells of " << index.cellSize() << " pixels ("
+         << index.references() << " references) in " << buildMs << " ms; picked " << points.size() << " points in "
+         << queryMs << " ms" << endl;
+    return true;
+}
+
+void printUsage() {
+    cout << "Usage: barycen [options] [input.txt | input.bmesh | input.obj]" << endl;
+    cout << "  -o <file>     output image (default: input name with .ppm)" << endl;
+    cout << "  --p3          write ASCII P3 instead of binary P6" << endl;
+    cout << "  --size <n>    longer side of the image an OBJ model is fitted to (default 1024)" << endl;
+    cout << "  --cull <mode> cull triangles wound none (default), cw or ccw on screen" << endl;
+    cout << "  --raster <b>  find the spans of triangle rows by solving their edge functions (edge), by walking" << endl;
+    cout << "                the edges down the rows (scanline) or by either, per triangle (auto, the default)" << endl;
+    cout << "  --perspective interpolate colors perspective-correctly, treating z as view distance" << endl;
+    cout << "  --texture <f> map a PPM image onto meshes with texture coordinates" << endl;
+    cout << "  --filter <m>  texture filter: the nearest texel (nearest) or 2x2 texels (bilinear, the default)" << endl;
+    cout << "                of the nearest mip level, or bilinear samples of the two nearest levels (trilinear)" << endl;
+    cout << "  --checker <n> shade meshes with texture coordinates as a checkerboard of n squares per unit" << endl;
+    cout << "  --stream      render faces while the file is read, in parallel bands of rows" << endl;
+    cout << "  --frames <f>  render an animation, one frame per line of 6 affine parameters a1 a2 b1 a3 a4 b2," << endl;
+    cout << "                to numbered files or, with -o -, to stdout as concatenated images" << endl;
+    cout << "  --threads <n> raster threads for --stream (default: one per core but one), frames for --frames" << endl;
+    cout << "                or threads blending translucent faces (default: one per core)" << endl;
+    cout << "  --orbit <yaw> <pitch>  view the mesh in 3D from a camera orbiting the image center (degrees)" << endl;
+    cout << "  --fov <deg>   vertical field of view of the camera (default 60)" << endl;
+    cout << "  --distance <s> camera distance, relative to the one that keeps the image size (default 1)" << endl;
+    cout << "  --ortho       orthographic camera (the default for --frames without other camera options)" << endl;
+    cout << "  --msaa <n>    anti-alias edges and intersections with 4 or 8 samples per pixel; costs about" << endl;
+    cout << "                1.5x the render time for large triangles but 2.5x to 5x for triangles a few pixels across" << endl;
+    cout << "  --band <rows> render and write the image in bands of rows, for images too large for memory" << endl;
+    cout << "  --bench <n>   time parse, render with each --raster backend and both output formats over n runs" << endl;
+    cout << "  --stats       report per-stage timings, pixel efficiency and overdraw of the render" << endl;
+    cout << "  --heatmap <f> with --stats, write how often each pixel was shaded as a heatmap image" << endl;
+    cout << "  --id-target <f>    also write the index of the face drawn at each pixel (PAM, 2 x 16 bits)" << endl;
+    cout << "  --depth-target <f> also write the depth buffer of a mesh with depth (16-bit PGM)" << endl;
+    cout << "  --bary-target <f>  also write the barycentric weights of each pixel in its face (16-bit PAM)" << endl;
+    cout << "  --pick <f>    instead of rendering, print the face drawn at each \"x y\" pixel listed in a file" << endl;
+    cout << "                and the barycentric weights of its vertices there, as \"x y face w1 w2 w3\"" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    string inputFile, outputFile, textureFile;
+    PPMEncoding encoding = PPM_BINARY;
+    RenderContext context;
+    int benchRuns = 0;
+    bool stream = false;
+    int bandRows = 0;
+    bool useCamera = false;
+    Camera camera;
+    string framesFile;
+    int threads = 0; // 0 picks the default of the mode
+    bool collectStats = false;
+    string heatmapFile;
+    RenderTargets targets;
+    string idTargetFile, depthTargetFile, baryTargetFile;
+    string pickFile;
+    int objImageSize = OBJ_DEFAULT_IMAGE_SIZE;
+
+    // Parse the command line options
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg == "--cull" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "none") {
+                context.options.cullMode = CULL_NONE;
+            } else if (mode == "cw") {
+                context.options.cullMode = CULL_CW;
+            } else if (mode == "ccw") {
+                context.options.cullMode = CULL_CCW;
+            } else {
+                cerr << "Error: --cull expects none, cw or ccw" << endl;
+                return 1;
+            }
+        } else if (arg == "--raster" && i + 1 < argc) {
+            string backend = argv[++i];
+            if (backend == "edge") {
+                context.options.raster = RASTER_EDGE;
+            } else if (backend == "scanline") {
+                context.options.raster = RASTER_SCANLINE;
+            } else if (backend == "auto") {
+                context.options.raster = RASTER_AUTO;
+            } else {
+                cerr << "Error: --raster expects edge, scanline or auto" << endl;
+                return 1;
+            }
+        } else if (arg == "--perspective") {
+            context.options.perspective = true;
+        } else if (arg == "--texture" && i + 1 < argc) {
+            textureFile = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            string filter = argv[++i];
+            if (filter == "nearest") {
+                context.options.filter = FILTER_NEAREST;
+            } else if (filter == "bilinear") {
+                context.options.filter = FILTER_BILINEAR;
+            } else if (filter == "trilinear") {
+                context.options.filter = FILTER_TRILINEAR;
+            } else {
+                cerr << "Error: --filter expects nearest, bilinear or trilinear" << endl;
+                return 1;
+            }
+        } else if (arg == "--checker" && i + 1 < argc) {
+            context.options.checker = max(1, atoi(argv[++i]));
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--orbit" && i + 2 < argc) {
+            useCamera = true;
+            camera.yaw = static_cast<float>(atof(argv[++i]));
+            camera.pitch = static_cast<float>(atof(argv[++i]));
+        } else if (arg == "--fov" && i + 1 < argc) {
+            useCamera = true;
+            camera.fovY = min(179.0f, max(1.0f, static_cast<float>(atof(argv[++i]))));
+        } else if (arg == "--distance" && i + 1 < argc) {
+            useCamera = true;
+            camera.distance = static_cast<float>(atof(argv[++i]));
+            if (!(camera.distance > 0)) {
+                cerr << "Error: --distance expects a positive scale" << endl;
+                return 1;
+            }
+        } else if (arg == "--ortho") {
+            useCamera = true;
+            camera.orthographic = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            framesFile = argv[++i];
+        } else if (arg == "--stats") {
+            collectStats = true;
+        } else if (arg == "--heatmap" && i + 1 < argc) {
+            collectStats = true;
+            heatmapFile = argv[++i];
+        } else if (arg == "--id-target" && i + 1 < argc) {
+            idTargetFile = argv[++i];
+            targets.enabled |= TARGET_FACE_ID;
+        } else if (arg == "--depth-target" && i + 1 < argc) {
+            depthTargetFile = argv[++i];
+        } else if (arg == "--bary-target" && i + 1 < argc) {
+            baryTargetFile = argv[++i];
+            targets.enabled |= TARGET_BARYCENTRIC;
+        } else if (arg == "--pick" && i + 1 < argc) {
+            pickFile = argv[++i];
+        } else if (arg == "--msaa" && i + 1 < argc) {
+            context.samples = atoi(argv[++i]);
+            if (context.samples != 4 && context.samples != 8) {
+                cerr << "Error: --msaa expects 4 or 8 samples" << endl;
+                return 1;
+            }
+        } else if (arg == "--band" && i + 1 < argc) {
+            bandRows = max(1, atoi(argv[++i]));
+        } else if (arg == "--size" && i + 1 < argc) {
+            objImageSize = max(1, atoi(argv[++i]));
+        } else if (arg == "--p3") {
+            encoding = PPM_ASCII;
+        } else if (arg == "--bench" && i + 1 < argc) {
+            benchRuns = max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            cerr << "Error: Unknown option " << arg << endl;
+            printUsage();
+            return 1;
+        } else {
+            inputFile = arg;
+        }
+    }
+
+    if (stream && (bandRows > 0 || useCamera || !framesFile.empty())) {
+        cerr << "Error: --band, --frames and camera options cannot be combined with --stream" << endl;
+        return 1;
+    }
+    if (!framesFile.empty() && bandRows > 0) {
+        cerr << "Error: --band cannot be combined with --frames" << endl;
+        return 1;
+    }
+    if (collectStats && (stream || bandRows > 0 || !framesFile.empty())) {
+        cerr << "Error: --stats and --heatmap only work on single whole-image renders" << endl;
+        return 1;
+    }
+    if (context.options.checker > 0 && !textureFile.empty()) {
+        cerr << "Error: --checker cannot be combined with --texture" << endl;
+        return 1;
+    }
+    if (context.samples > 1 && (stream || bandRows > 0 || collectStats)) {
+        cerr << "Error: --msaa cannot be combined with --stream, --band or --stats" << endl;
+        return 1;
+    }
+    bool extraTargets = targets.enabled != 0 || !depthTargetFile.empty();
+    if (extraTargets && (stream || bandRows > 0 || !framesFile.empty() || collectStats || context.samples > 1)) {
+        cerr << "Error: render targets cannot be combined with --stream, --band, --frames, --stats or --msaa" << endl;
+        return 1;
+    }
+    if (!pickFile.empty() && (stream || bandRows > 0 || !framesFile.empty() || benchRuns > 0 || collectStats || extraTargets)) {
+        cerr << "Error: --pick cannot be combined with --stream, --band, --frames, --bench, --stats or render targets" << endl;
+        return 1;
+    }
+    if (targets.enabled) context.targets = &targets;
+    int cores = static_cast<int>(thread::hardware_concurrency());
+    context.threads = threads > 0 ? threads : max(1, cores);
+    int streamThreads = threads > 0 ? threads : max(1, cores - 1); // One core parses
 
-    // Variables to store image size, vertices, and faces
-    int width = 0, height = 0;
-    Vertex* vertices = nullptr;
-    int numVertices = 0;
-    Face* faces = nullptr;
-    int numFaces = 0;
+    // Prompt the user for the input file name if none was given
+    if (inputFile.empty()) {
+        cout << "Enter the input file name: ";
+        cin >> inputFile;
+    }
+    if (outputFile.empty()) {
+        outputFile = inputFile.substr(0, inputFile.find_last_of('.')) + ".ppm";
+    }
+    if (stream && isObjFile(inputFile)) {
+        cerr << "Error: --stream reads text and binary meshes; OBJ files are parsed in parallel as a whole" << endl;
+        return 1;
+    }
 
-    // Read the input file
-    readInputFile(inputFile, width, height, vertices, numVertices, faces, numFaces);
+    Texture texture;
+    if (!textureFile.empty()) {
+        if (!loadTexture(textureFile, texture)) {
+            exit(1); // Exit if the texture cannot be read
+        }
+        context.options.texture = &texture;
+    }
+
+    if (benchRuns > 0) {
+        runBenchmark<DefaultFormat>(inputFile, outputFile, context, benchRuns, stream ? streamThreads : 0,
+                                    useCamera ? &camera : nullptr, objImageSize);
+    }
+
+    RenderStats stats;
+    if (collectStats) context.stats = &stats;
+    uint32_t numFaces = 0;
+
+    Framebuffer<DefaultFormat> image;
+    if (stream) {
+        // Render the faces as they are read
+        string error;
+        if (!renderMeshStream(inputFile, image, context, streamThreads, error)) {
+            cerr << "Error: " << error << endl;
+            exit(1); // Exit if the file cannot be opened or parsed
+        }
+    } else {
+        // Read the input file
+        LoadedMesh mesh;
+        auto start = chrono::steady_clock::now();
+        readInputFile(inputFile, mesh, objImageSize);
+        stats.parseMs = elapsedMs(start);
+        if (pickFile.empty() && !canBlendTranslucentFaces(mesh.view, context, bandRows > 0)) {
+            exit(1); // Exit if the translucent faces cannot be blended
+        }
 
-    // Create a blank image (1D array: width * height * 3 for RGB)
-    int* image = new int[width * height * 3]{0}; // Initialize to black
+        if (!framesFile.empty()) {
+            // Render the animation from the one loaded mesh
+            vector<Mat4> frames;
+            string error;
+            if (!readAffineFrames(framesFile, frames, error)) {
+                cerr << "Error: " << error << endl;
+                exit(1); // Exit if the frames cannot be read
+            }
+            if (!useCamera) camera.orthographic = true; // Plain 2D affine frames
+            bool toStdout = outputFile == "-";
+#ifdef _WIN32
+            if (toStdout) _setmode(_fileno(stdout), _O_BINARY); // Frames are binary data
+#endif
+            int frameThreads = threads > 0 ? threads : max(1, cores);
+            start = chrono::steady_clock::now();
+            if (!renderAnimation<DefaultFormat>(mesh.view, context, frames, camera, frameThreads, outputFile, encoding)) {
+                exit(1); // Exit if a frame cannot be written
+            }
+            double ms = elapsedMs(start);
+            (toStdout ? cerr : cout) << "Rendered " << frames.size() << " frames in " << ms << " ms ("
+                                     << frames.size() * 1000.0 / ms << " frames/s, " << frameThreads << " threads)"
+                                     << (toStdout ? " to stdout" : ", saved as " + frameFileName(outputFile, 0) + " ...")
+                                     << endl;
+            return 0;
+        }
 
-    // Render each triangle
-    for (int i = 0; i < numFaces; ++i) {
-        renderTriangle(image, width, height, vertices, faces[i]);
+        // Project the vertices when viewing the mesh through a camera
+        MeshView view = mesh.view;
+        TransformStage transform;
+        if (useCamera) {
+            transform.load(view);
+            start = chrono::steady_clock::now();
+            view = transform.project(view, Mat4::identity(), camera);
+            stats.transformMs = elapsedMs(start);
+        }
+        numFaces = view.numFaces;
+
+        if (!pickFile.empty()) {
+            // Answer the pick queries instead of rendering
+            if (!pickFaces(view, context.options.cullMode, pickFile, threads > 0 ? threads : max(1, cores))) {
+                exit(1); // Exit if the points cannot be read
+            }
+            return 0;
+        }
+
+        if (bandRows > 0) {
+            // Render and save the image one band of rows at a time
+            if (!renderMeshBands<DefaultFormat>(view, context, bandRows, outputFile, encoding)) {
+                exit(1); // Exit if the file cannot be written
+            }
+            cout << "Image saved as " << outputFile << endl;
+            return 0;
+        }
+
+        if (!depthTargetFile.empty() && !view.z) {
+            cerr << "Error: --depth-target needs a mesh with per-vertex depth" << endl;
+            exit(1);
+        }
+
+        // Render each triangle into a blank image
+        image.resize(view.width, view.height);
+        renderMesh(image, context, view);
+        if (context.translucentFaces > 0) {
+            cout << "Blended " << context.translucentFaces << " translucent faces: " << context.fragments << " fragments, "
+                 << context.fragmentsDropped << " dropped beyond " << FRAGMENT_LIST_SIZE << " per pixel" << endl;
+        }
     }
 
     // Save the output image as a .ppm file
-    string outputFile = inputFile.substr(0, inputFile.find_last_of('.')) + ".ppm";
-    writePPMFile(outputFile, image, width, height);
+    auto start = chrono::steady_clock::now();
+    if (!writePPMFile(outputFile, image, encoding)) {
+        exit(1); // Exit if the file cannot be created
+    }
+    stats.writeMs = elapsedMs(start);
     cout << "Image saved as " << outputFile << endl;
 
-    // Free dynamically allocated memory/ de-allocating
-    delete[] image;
-    delete[] vertices;
-    delete[] faces;
+    if (context.stats) {
+        MappedFile file;
+        printRenderStats(context, numFaces, file.open(inputFile) ? file.size() / 1e6 : 0);
+        if (!heatmapFile.empty()) {
+            if (!writeHeatmapPPM(heatmapFile, stats.overdraw)) {
+                exit(1); // Exit if the file cannot be created
+            }
+            cout << "Overdraw heatmap saved as " << heatmapFile << endl;
+        }
+    }
+
+    // Save the extra render targets
+    if (!idTargetFile.empty()) {
+        if (!writeFaceIdPAM(idTargetFile, targets.faceIds)) {
+            exit(1); // Exit if the file cannot be created
+        }
+        cout << "Face IDs saved as " << idTargetFile << endl;
+    }
+    if (!depthTargetFile.empty()) {
+        if (useCamera && !camera.orthographic) {
+            // Perspective depth is -1 / view distance; write the distance itself
+            for (float& z : context.depth.depth.pixels) z = z != numeric_limits<float>::infinity() ? -1 / z : z;
+        }
+        float nearZ, farZ;
+        if (!writeDepthPGM(depthTargetFile, context.depth.depth, nearZ, farZ)) {
+            exit(1); // Exit if the file cannot be created
+        }
+        cout << "Depth saved as " << depthTargetFile << " (0 is z = " << nearZ << ", 65534 is z = " << farZ << ")" << endl;
+    }
+    if (!baryTargetFile.empty()) {
+        if (!writeBarycentricPAM(baryTargetFile, targets.barycentrics)) {
+            exit(1); // Exit if the file cannot be created
+        }
+        cout << "Barycentric weights saved as " << baryTargetFile << endl;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,605 @@
+// Bounding volume hierarchy over the triangles of a mesh, for casting rays.
+//
+// Triangles are kept in the mesh's image space: x right and y down in pixels,
+// and z (the vertex depth times a scale) away from the viewer. The ray looking
+// into the image through pixel (x, y) starts at (x, y, 0) with direction
+// (0, 0, 1), so its distance to a hit is the depth there.
+//
+// The tree is built with the surface area heuristic over 16 centroid bins per
+// axis. Large nodes are binned by several threads, and below the root the two
+// halves of a node are built by different threads until every thread has a
+// subtree of its own. Nodes are allocated in sibling pairs from one atomic
+// counter, so subtrees built in parallel share a single node array.
+//
+// Rays are traced in packets of 4 that walk the tree together: a node is
+// entered when any ray of the packet hits its box, and boxes and triangles are
+// tested against all 4 rays at once (with AVX when the compiler targets it,
+// else SSE2). Triangles are intersected with Moller-Trumbore in double
+// precision, which is exact for integer vertices and rays along z through
+// pixel centers: a pixel on an edge belongs to both triangles and no pixel
+// falls between two, as in the rasterizer.
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "mesh_io.h"
+
+const int BVH_BINS = 16;
+const uint32_t BVH_LEAF_SIZE = 4;              // Nodes this small always become leaves
+const uint32_t BVH_MAX_LEAF_SIZE = 16;         // Larger nodes are split even when the SAH prefers a leaf
+const uint32_t BVH_PARALLEL_BIN_SIZE = 1 << 16; // Nodes with more triangles are binned by several threads
+const int BVH_SAH_DEPTH = 64;                  // Deeper nodes are split at the median, bounding the depth
+const int BVH_STACK_SIZE = 128;
+const uint32_t BVH_NO_HIT = 0xFFFFFFFF;
+const int RAY_PACKET_SIZE = 4;
+
+struct BVHBox {
+    float min[3], max[3];
+
+    static BVHBox empty() {
+        const float inf = std::numeric_limits<float>::infinity();
+        return BVHBox{ { inf, inf, inf }, { -inf, -inf, -inf } };
+    }
+
+    void grow(const BVHBox& b) {
+        for (int k = 0; k < 3; ++k) {
+            min[k] = std::min(min[k], b.min[k]);
+            max[k] = std::max(max[k], b.max[k]);
+        }
+    }
+
+    void grow(const float* p) {
+        for (int k = 0; k < 3; ++k) {
+            min[k] = std::min(min[k], p[k]);
+            max[k] = std::max(max[k], p[k]);
+        }
+    }
+
+    // Half the surface area, the probability weight of the SAH
+    double halfArea() const {
+        if (min[0] > max[0]) return 0;
+        double dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+struct BVHNode {
+    BVHBox box;
+    uint32_t index;  // First triangle of a leaf, or the first of the two children of an inner node
+    uint16_t count;  // Triangles of a leaf, 0 for an inner node
+    uint16_t axis;   // Axis an inner node was split on
+};
+
+// Triangle as stored for intersection: a vertex and the two edges leaving it
+struct BVHTriangle {
+    float v0[3], e1[3], e2[3];
+    uint32_t face; // Index of the face in the mesh
+};
+
+struct BVH {
+    std::vector<BVHNode> nodes;         // nodes[0] is the root
+    std::vector<BVHTriangle> triangles; // In leaf order
+};
+
+// Packet of rays traced together. Lanes that are not used get tMin > tMax.
+struct RayPacket {
+    double ox[RAY_PACKET_SIZE], oy[RAY_PACKET_SIZE], oz[RAY_PACKET_SIZE];
+    double dx[RAY_PACKET_SIZE], dy[RAY_PACKET_SIZE], dz[RAY_PACKET_SIZE];
+    double invX[RAY_PACKET_SIZE], invY[RAY_PACKET_SIZE], invZ[RAY_PACKET_SIZE];
+    double tMin[RAY_PACKET_SIZE], tMax[RAY_PACKET_SIZE];
+    uint32_t skipFace[RAY_PACKET_SIZE]; // Face a ray ignores (the surface it leaves), or BVH_NO_HIT
+
+    void setRay(int lane, double x, double y, double z, double dirX, double dirY, double dirZ, double t0, double t1) {
+        ox[lane] = x;
+        oy[lane] = y;
+        oz[lane] = z;
+        // Directions along an axis must have +0, never -0, so their inverse is +infinity
+        dx[lane] = dirX == 0 ? 0.0 : dirX;
+        dy[lane] = dirY == 0 ? 0.0 : dirY;
+        dz[lane] = dirZ == 0 ? 0.0 : dirZ;
+        invX[lane] = 1.0 / dx[lane];
+        invY[lane] = 1.0 / dy[lane];
+        invZ[lane] = 1.0 / dz[lane];
+        tMin[lane] = t0;
+        tMax[lane] = t1;
+        skipFace[lane] = BVH_NO_HIT;
+    }
+
+    void disable(int lane) {
+        setRay(lane, 0, 0, 0, 0, 0, 1, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity());
+    }
+};
+
+// Closest hit of each ray of a packet; u and v weight the second and third
+// vertex of the face
+struct PacketHit {
+    double t[RAY_PACKET_SIZE], u[RAY_PACKET_SIZE], v[RAY_PACKET_SIZE];
+    uint32_t face[RAY_PACKET_SIZE]; // BVH_NO_HIT for rays that hit nothing
+};
+
+// Triangles skipped by the sign of their Moller-Trumbore determinant; for rays
+// along +z, a clockwise triangle on screen (y down) has a negative determinant
+enum RayCull {
+    RAY_CULL_NONE,
+    RAY_CULL_NEGATIVE,
+    RAY_CULL_POSITIVE
+};
+
+// How the closest hit is chosen between hits at the same distance, rounded to
+// float as the rasterizer's depth buffer stores it
+enum HitOrder {
+    HIT_FIRST_FACE, // The earlier face, as the depth test keeps the first fragment of a depth
+    HIT_LAST_FACE   // The later face, as painter's order draws over
+};
+
+// Builds the tree of one mesh; see buildBVH
+struct BVHBuilder {
+    std::vector<BVHBox> bounds;      // Of every triangle
+    std::vector<float> centroids;    // 3 per triangle
+    std::vector<uint32_t> order;     // Triangle indices, partitioned into the leaves
+    std::vector<BVHNode>& nodes;
+    std::atomic<uint32_t> nodeCount{ 1 };
+
+    explicit BVHBuilder(std::vector<BVHNode>& output) : nodes(output) {}
+
+    // Centroid bins of a node and the bounds they are computed in
+    struct Bins {
+        BVHBox box[3][BVH_BINS];
+        uint32_t count[3][BVH_BINS];
+    };
+
+    static int binOf(float c, float low, float scale) {
+        return std::min(BVH_BINS - 1, static_cast<int>((c - low) * scale));
+    }
+
+    // Function to run body(slice, begin, end) on up to 'threads' slices of [begin, end)
+    template <typename Body>
+    static void slices(uint32_t begin, uint32_t end, int threads, Body body) {
+        uint32_t count = end - begin;
+        int n = std::max(1, std::min(threads, static_cast<int>(count / BVH_PARALLEL_BIN_SIZE)));
+        if (n == 1) {
+            body(0, begin, end);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (int s = 0; s < n; ++s) {
+            workers.emplace_back(body, s, begin + static_cast<uint32_t>(uint64_t(count) * s / n),
+                                 begin + static_cast<uint32_t>(uint64_t(count) * (s + 1) / n));
+        }
+        for (std::thread& t : workers) t.join();
+    }
+
+    // Function to compute the box of the triangles [begin, end) and of their centroids
+    void measure(uint32_t begin, uint32_t end, int threads, BVHBox& box, BVHBox& centroidBox) {
+        std::vector<BVHBox> boxes(static_cast<size_t>(threads) * 2, BVHBox::empty());
+        slices(begin, end, threads, [&](int s, uint32_t b, uint32_t e) {
+            BVHBox& sliceBox = boxes[2 * s];
+            BVHBox& sliceCentroids = boxes[2 * s + 1];
+            for (uint32_t i = b; i < e; ++i) {
+                sliceBox.grow(bounds[order[i]]);
+                sliceCentroids.grow(&centroids[3 * size_t(order[i])]);
+            }
+        });
+        box = centroidBox = BVHBox::empty();
+        for (int s = 0; s < threads; ++s) {
+            box.grow(boxes[2 * s]);
+            centroidBox.grow(boxes[2 * s + 1]);
+        }
+    }
+
+    // Function to count the triangles [begin, end) into bins along every axis
+    void bin(uint32_t begin, uint32_t end, int threads, const BVHBox& centroidBox, const float* scale, Bins& result) {
+        std::vector<Bins> partial(static_cast<size_t>(threads));
+        for (Bins& bins : partial) {
+            for (int axis = 0; axis < 3; ++axis) {
+                std::fill(bins.box[axis], bins.box[axis] + BVH_BINS, BVHBox::empty());
+                std::fill(bins.count[axis], bins.count[axis] + BVH_BINS, 0u);
+            }
+        }
+        slices(begin, end, threads, [&](int s, uint32_t b, uint32_t e) {
+            Bins& bins = partial[s];
+            for (uint32_t i = b; i < e; ++i) {
+                const float* c = &centroids[3 * size_t(order[i])];
+                for (int axis = 0; axis < 3; ++axis) {
+                    int k = binOf(c[axis], centroidBox.min[axis], scale[axis]);
+                    bins.box[axis][k].grow(bounds[order[i]]);
+                    bins.count[axis][k]++;
+                }
+            }
+        });
+        result = partial[0];
+        for (int s = 1; s < threads; ++s) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int k = 0; k < BVH_BINS; ++k) {
+                    result.box[axis][k].grow(partial[s].box[axis][k]);
+                    result.count[axis][k] += partial[s].count[axis][k];
+                }
+            }
+        }
+    }
+
+    // Function to build node over the triangles [begin, end) with 'threads' threads
+    void build(uint32_t node, uint32_t begin, uint32_t end, int depth, int threads) {
+        uint32_t count = end - begin;
+        BVHBox box, centroidBox;
+        measure(begin, end, threads, box, centroidBox);
+        BVHNode& n = nodes[node];
+        n.box = box;
+        n.axis = 0;
+        if (count <= BVH_LEAF_SIZE) {
+            n.index = begin;
+            n.count = static_cast<uint16_t>(count);
+            return;
+        }
+
+        // Best SAH split over the bins of every axis
+        int bestAxis = -1, bestBin = 0;
+        double bestCost = std::numeric_limits<double>::infinity();
+        float scale[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            float extent = centroidBox.max[axis] - centroidBox.min[axis];
+            scale[axis] = extent > 0 ? BVH_BINS / extent : 0;
+        }
+        if (depth < BVH_SAH_DEPTH) {
+            Bins bins;
+            bin(begin, end, threads, centroidBox, scale, bins);
+            for (int axis = 0; axis < 3; ++axis) {
+                if (scale[axis] == 0) continue;
+                double rightArea[BVH_BINS];
+                uint32_t rightCount[BVH_BINS];
+                BVHBox right = BVHBox::empty();
+                uint32_t rightTotal = 0;
+                for (int k = BVH_BINS - 1; k > 0; --k) {
+                    right.grow(bins.box[axis][k]);
+                    rightTotal += bins.count[axis][k];
+                    rightArea[k] = right.halfArea();
+                    rightCount[k] = rightTotal;
+                }
+                BVHBox left = BVHBox::empty();
+                uint32_t leftTotal = 0;
+                for (int k = 1; k < BVH_BINS; ++k) { // Split between bins k - 1 and k
+                    left.grow(bins.box[axis][k - 1]);
+                    leftTotal += bins.count[axis][k - 1];
+                    if (leftTotal == 0 || rightCount[k] == 0) continue;
+                    double cost = left.halfArea() * leftTotal + rightArea[k] * rightCount[k];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = k;
+                    }
+                }
+            }
+        }
+
+        // A leaf costs one test per triangle, a split one box test plus its children
+        double area = box.halfArea();
+        bool split = bestAxis >= 0 && (count > BVH_MAX_LEAF_SIZE || area + bestCost < area * count);
+        uint32_t middle;
+        if (split) {
+            const float low = centroidBox.min[bestAxis], s = scale[bestAxis];
+            const int axis = bestAxis, splitBin = bestBin;
+            middle = static_cast<uint32_t>(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t t) {
+                return binOf(centroids[3 * size_t(t) + axis], low, s) < splitBin;
+            }) - order.begin());
+            n.axis = static_cast<uint16_t>(bestAxis);
+        } else if (count > BVH_MAX_LEAF_SIZE) {
+            // No usable split: halve along the widest centroid extent, or anyhow when all centroids coincide
+            int axis = 0;
+            for (int k = 1; k < 3; ++k) {
+                if (centroidBox.max[k] - centroidBox.min[k] > centroidBox.max[axis] - centroidBox.min[axis]) axis = k;
+            }
+            middle = begin + count / 2;
+            std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) {
+                return centroids[3 * size_t(a) + axis] < centroids[3 * size_t(b) + axis];
+            });
+            n.axis = static_cast<uint16_t>(axis);
+        } else {
+            n.index = begin;
+            n.count = static_cast<uint16_t>(count);
+            return;
+        }
+
+        uint32_t children = nodeCount.fetch_add(2);
+        n.index = children;
+        n.count = 0;
+        if (threads > 1) {
+            // The halves are built in parallel, each with its share of the threads
+            int leftThreads = threads / 2;
+            std::thread left([this, children, begin, middle, depth, leftThreads] { build(children, begin, middle, depth + 1, leftThreads); });
+            build(children + 1, middle, end, depth + 1, threads - leftThreads);
+            left.join();
+        } else {
+            build(children, begin, middle, depth + 1, 1);
+            build(children + 1, middle, end, depth + 1, 1);
+        }
+    }
+};
+
+// Function to build the tree over the faces of a mesh, with z multiplied by
+// depthScale; faces with invalid vertex indices are left out
+inline void buildBVH(const MeshView& mesh, float depthScale, int threads, BVH& bvh) {
+    std::vector<BVHTriangle> triangles;
+    triangles.reserve(mesh.numFaces);
+    for (uint32_t f = 0; f < mesh.numFaces; ++f) {
+        const Face& face = mesh.faces[f];
+        if (face.v1 >= mesh.numVertices || face.v2 >= mesh.numVertices || face.v3 >= mesh.numVertices) continue;
+        const uint32_t index[3] = { face.v1, face.v2, face.v3 };
+        float p[3][3];
+        for (int k = 0; k < 3; ++k) {
+            p[k][0] = static_cast<float>(mesh.x[index[k]]);
+            p[k][1] = static_cast<float>(mesh.y[index[k]]);
+            p[k][2] = mesh.z ? mesh.z[index[k]] * depthScale : 0.0f;
+        }
+        BVHTriangle t;
+        for (int k = 0; k < 3; ++k) {
+            t.v0[k] = p[0][k];
+            t.e1[k] = p[1][k] - p[0][k];
+            t.e2[k] = p[2][k] - p[0][k];
+        }
+        t.face = f;
+        triangles.push_back(t);
+    }
+
+    const uint32_t count = static_cast<uint32_t>(triangles.size());
+    bvh.nodes.assign(std::max<size_t>(1, 2 * size_t(count)), BVHNode{ BVHBox::empty(), 0, 0, 0 });
+    BVHBuilder builder(bvh.nodes);
+    builder.bounds.resize(count);
+    builder.centroids.resize(3 * size_t(count));
+    builder.order.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const BVHTriangle& t = triangles[i];
+        BVHBox box = BVHBox::empty();
+        float p[3];
+        box.grow(t.v0);
+        for (int k = 0; k < 3; ++k) p[k] = t.v0[k] + t.e1[k];
+        box.grow(p);
+        for (int k = 0; k < 3; ++k) p[k] = t.v0[k] + t.e2[k];
+        box.grow(p);
+        builder.bounds[i] = box;
+        for (int k = 0; k < 3; ++k) builder.centroids[3 * size_t(i) + k] = (box.min[k] + box.max[k]) / 2;
+        builder.order[i] = i;
+    }
+    if (count > 0) builder.build(0, 0, count, 0, std::max(1, threads));
+    bvh.nodes.resize(builder.nodeCount);
+
+    // Store the triangles in leaf order
+    bvh.triangles.resize(count);
+    for (uint32_t i = 0; i < count; ++i) bvh.triangles[i] = triangles[builder.order[i]];
+}
+
+// One double per ray of a packet, with the operations the box and triangle
+// tests need: AVX when the compiler targets it, else two SSE2 halves, else a
+// plain loop. Comparisons give all-ones lanes; min and max return their second
+// operand when either is NaN, as the SSE instructions do.
+struct RayLanes {
+#ifdef __AVX__
+    __m256d v;
+
+    static RayLanes load(const double* p) { return { _mm256_loadu_pd(p) }; }
+    static RayLanes set(double x) { return { _mm256_set1_pd(x) }; }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+    friend RayLanes operator+(RayLanes a, RayLanes b) { return { _mm256_add_pd(a.v, b.v) }; }
+    friend RayLanes operator-(RayLanes a, RayLanes b) { return { _mm256_sub_pd(a.v, b.v) }; }
+    friend RayLanes operator*(RayLanes a, RayLanes b) { return { _mm256_mul_pd(a.v, b.v) }; }
+    friend RayLanes operator/(RayLanes a, RayLanes b) { return { _mm256_div_pd(a.v, b.v) }; }
+    friend RayLanes operator&(RayLanes a, RayLanes b) { return { _mm256_and_pd(a.v, b.v) }; }
+    friend RayLanes operator^(RayLanes a, RayLanes b) { return { _mm256_xor_pd(a.v, b.v) }; }
+    friend RayLanes min(RayLanes a, RayLanes b) { return { _mm256_min_pd(a.v, b.v) }; }
+    friend RayLanes max(RayLanes a, RayLanes b) { return { _mm256_max_pd(a.v, b.v) }; }
+    friend RayLanes lessEqual(RayLanes a, RayLanes b) { return { _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ) }; }
+    friend RayLanes greater(RayLanes a, RayLanes b) { return { _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ) }; }
+    int signMask() const { return _mm256_movemask_pd(v); } // Sign bit of each lane
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d v[2];
+
+    static RayLanes load(const double* p) { return { { _mm_loadu_pd(p), _mm_loadu_pd(p + 2) } }; }
+    static RayLanes set(double x) { return { { _mm_set1_pd(x), _mm_set1_pd(x) } }; }
+    void store(double* p) const {
+        _mm_storeu_pd(p, v[0]);
+        _mm_storeu_pd(p + 2, v[1]);
+    }
+    friend RayLanes operator+(RayLanes a, RayLanes b) { return { { _mm_add_pd(a.v[0], b.v[0]), _mm_add_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes operator-(RayLanes a, RayLanes b) { return { { _mm_sub_pd(a.v[0], b.v[0]), _mm_sub_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes operator*(RayLanes a, RayLanes b) { return { { _mm_mul_pd(a.v[0], b.v[0]), _mm_mul_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes operator/(RayLanes a, RayLanes b) { return { { _mm_div_pd(a.v[0], b.v[0]), _mm_div_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes operator&(RayLanes a, RayLanes b) { return { { _mm_and_pd(a.v[0], b.v[0]), _mm_and_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes operator^(RayLanes a, RayLanes b) { return { { _mm_xor_pd(a.v[0], b.v[0]), _mm_xor_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes min(RayLanes a, RayLanes b) { return { { _mm_min_pd(a.v[0], b.v[0]), _mm_min_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes max(RayLanes a, RayLanes b) { return { { _mm_max_pd(a.v[0], b.v[0]), _mm_max_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes lessEqual(RayLanes a, RayLanes b) { return { { _mm_cmple_pd(a.v[0], b.v[0]), _mm_cmple_pd(a.v[1], b.v[1]) } }; }
+    friend RayLanes greater(RayLanes a, RayLanes b) { return { { _mm_cmpgt_pd(a.v[0], b.v[0]), _mm_cmpgt_pd(a.v[1], b.v[1]) } }; }
+    int signMask() const { return _mm_movemask_pd(v[0]) | _mm_movemask_pd(v[1]) << 2; }
+#else
+    double v[RAY_PACKET_SIZE];
+
+    template <typename Op>
+    static RayLanes map(RayLanes a, RayLanes b, Op op) {
+        RayLanes r;
+        for (int i = 0; i < RAY_PACKET_SIZE; ++i) r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+    static uint64_t raw(double x) {
+        uint64_t r;
+        std::memcpy(&r, &x, sizeof(r));
+        return r;
+    }
+    static double cooked(uint64_t r) {
+        double x;
+        std::memcpy(&x, &r, sizeof(x));
+        return x;
+    }
+    static double bits(bool b) { return cooked(b ? ~uint64_t(0) : 0); }
+
+    static RayLanes load(const double* p) {
+        RayLanes r;
+        std::memcpy(r.v, p, sizeof(r.v));
+        return r;
+    }
+    static RayLanes set(double x) { return { { x, x, x, x } }; }
+    void store(double* p) const { std::memcpy(p, v, sizeof(v)); }
+    friend RayLanes operator+(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return x + y; }); }
+    friend RayLanes operator-(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return x - y; }); }
+    friend RayLanes operator*(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return x * y; }); }
+    friend RayLanes operator/(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return x / y; }); }
+    friend RayLanes operator&(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return cooked(raw(x) & raw(y)); }); }
+    friend RayLanes operator^(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return cooked(raw(x) ^ raw(y)); }); }
+    friend RayLanes min(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return x < y ? x : y; }); }
+    friend RayLanes max(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return x > y ? x : y; }); }
+    friend RayLanes lessEqual(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return bits(x <= y); }); }
+    friend RayLanes greater(RayLanes a, RayLanes b) { return map(a, b, [](double x, double y) { return bits(x > y); }); }
+    int signMask() const {
+        int mask = 0;
+        for (int i = 0; i < RAY_PACKET_SIZE; ++i) mask |= static_cast<int>(raw(v[i]) >> 63) << i;
+        return mask;
+    }
+#endif
+};
+
+// Function to test the rays of a packet against a box; returns a bit per lane
+// whose ray enters the box within [tMin, tFar]. An axis the ray runs along has
+// an infinite inverse direction, making the slab distances infinite or, when
+// the origin is on the box face, NaN; NaN is read as the ray being inside.
+inline int packetHitsBox(const RayPacket& ray, const BVHBox& box, const double* tFar) {
+    const RayLanes inf = RayLanes::set(std::numeric_limits<double>::infinity());
+    const RayLanes negInf = RayLanes::set(-std::numeric_limits<double>::infinity());
+    const double* origin[3] = { ray.ox, ray.oy, ray.oz };
+    const double* inverse[3] = { ray.invX, ray.invY, ray.invZ };
+    RayLanes tNear = RayLanes::load(ray.tMin), tLimit = RayLanes::load(tFar);
+    for (int k = 0; k < 3; ++k) {
+        RayLanes o = RayLanes::load(origin[k]), inv = RayLanes::load(inverse[k]);
+        RayLanes lo = max((RayLanes::set(box.min[k]) - o) * inv, negInf); // NaN takes the second operand
+        RayLanes hi = min((RayLanes::set(box.max[k]) - o) * inv, inf);
+        tNear = max(tNear, min(lo, hi));
+        tLimit = min(tLimit, max(lo, hi));
+    }
+    return lessEqual(tNear, tLimit).signMask();
+}
+
+// Function to intersect the rays of a packet with a triangle (Moller-Trumbore);
+// returns a bit per lane whose ray hits it within [tMin, tFar], with its
+// distance and the weights u, v of the second and third vertex. Edges are
+// inclusive; triangles of zero area and, with cull, one winding are never hit.
+inline int packetHitsTriangle(const RayPacket& ray, const BVHTriangle& tri, const double* tFar, RayCull cull,
+                              double* t, double* u, double* v) {
+    const RayLanes e1x = RayLanes::set(tri.e1[0]), e1y = RayLanes::set(tri.e1[1]), e1z = RayLanes::set(tri.e1[2]);
+    const RayLanes e2x = RayLanes::set(tri.e2[0]), e2y = RayLanes::set(tri.e2[1]), e2z = RayLanes::set(tri.e2[2]);
+    const RayLanes dx = RayLanes::load(ray.dx), dy = RayLanes::load(ray.dy), dz = RayLanes::load(ray.dz);
+    const RayLanes sx = RayLanes::load(ray.ox) - RayLanes::set(tri.v0[0]);
+    const RayLanes sy = RayLanes::load(ray.oy) - RayLanes::set(tri.v0[1]);
+    const RayLanes sz = RayLanes::load(ray.oz) - RayLanes::set(tri.v0[2]);
+    RayLanes px = dy * e2z - dz * e2y, py = dz * e2x - dx * e2z, pz = dx * e2y - dy * e2x;
+    RayLanes qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+    RayLanes det = e1x * px + e1y * py + e1z * pz;
+
+    // Make the determinant positive by flipping the sign of everything divided by it
+    RayLanes sign = det & RayLanes::set(-0.0);
+    RayLanes absDet = det ^ sign;
+    RayLanes uu = (sx * px + sy * py + sz * pz) ^ sign;
+    RayLanes vv = (dx * qx + dy * qy + dz * qz) ^ sign;
+    RayLanes tt = ((e2x * qx + e2y * qy + e2z * qz) ^ sign) / absDet;
+    const RayLanes zero = RayLanes::set(0);
+    RayLanes inside = lessEqual(zero, uu) & lessEqual(zero, vv) & lessEqual(uu + vv, absDet) & greater(absDet, zero);
+    inside = inside & lessEqual(RayLanes::load(ray.tMin), tt) & lessEqual(tt, RayLanes::load(tFar));
+    int mask = inside.signMask();
+    if (cull != RAY_CULL_NONE) mask &= cull == RAY_CULL_NEGATIVE ? ~det.signMask() : det.signMask();
+    if (mask) {
+        tt.store(t);
+        (uu / absDet).store(u);
+        (vv / absDet).store(v);
+    }
+    return mask;
+}
+
+// Function to find the closest hit of every ray of a packet. Distances are
+// compared rounded to float; ties go to the first or last face by order.
+inline void intersectPacket(const BVH& bvh, const RayPacket& ray, RayCull cull, HitOrder order, PacketHit& hit) {
+    double tFar[RAY_PACKET_SIZE];
+    for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+        tFar[i] = ray.tMax[i];
+        hit.face[i] = BVH_NO_HIT;
+    }
+    if (bvh.triangles.empty()) return;
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode& node = bvh.nodes[stack[--top]];
+        if (!packetHitsBox(ray, node.box, tFar)) continue;
+        if (node.count == 0) {
+            // Visit the child on the side the rays come from first
+            const double* d = node.axis == 0 ? ray.dx : node.axis == 1 ? ray.dy : ray.dz;
+            bool backwards = d[0] < 0;
+            stack[top++] = node.index + (backwards ? 0 : 1);
+            stack[top++] = node.index + (backwards ? 1 : 0);
+            continue;
+        }
+        for (uint32_t k = node.index; k < node.index + node.count; ++k) {
+            const BVHTriangle& tri = bvh.triangles[k];
+            double t[RAY_PACKET_SIZE], u[RAY_PACKET_SIZE], v[RAY_PACKET_SIZE];
+            int mask = packetHitsTriangle(ray, tri, tFar, cull, t, u, v);
+            for (int i = 0; mask; ++i, mask >>= 1) {
+                if (!(mask & 1) || tri.face == ray.skipFace[i]) continue;
+                double depth = static_cast<float>(t[i]);
+                bool closer = hit.face[i] == BVH_NO_HIT || depth < hit.t[i];
+                bool tie = !closer && depth == hit.t[i] &&
+                           (order == HIT_FIRST_FACE ? tri.face < hit.face[i] : tri.face > hit.face[i]);
+                if (!closer && !tie) continue;
+                hit.t[i] = depth;
+                hit.u[i] = u[i];
+                hit.v[i] = v[i];
+                hit.face[i] = tri.face;
+                // Keep looking for ties: anything that still rounds to this depth
+                tFar[i] = std::nextafter(static_cast<float>(depth), std::numeric_limits<float>::infinity());
+            }
+        }
+    }
+}
+
+// Function to find which rays of a packet hit anything within [tMin, tMax];
+// returns a bit per occluded lane. Tracing stops once every ray is blocked.
+inline int occludedPacket(const BVH& bvh, const RayPacket& ray) {
+    if (bvh.triangles.empty()) return 0;
+    RayPacket pending = ray;
+    int active = 0, occluded = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; ++i) active |= (ray.tMin[i] <= ray.tMax[i]) << i;
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0 && active) {
+        const BVHNode& node = bvh.nodes[stack[--top]];
+        if (!packetHitsBox(pending, node.box, pending.tMax)) continue;
+        if (node.count == 0) {
+            stack[top++] = node.index + 1;
+            stack[top++] = node.index;
+            continue;
+        }
+        for (uint32_t k = node.index; k < node.index + node.count && active; ++k) {
+            const BVHTriangle& tri = bvh.triangles[k];
+            double t[RAY_PACKET_SIZE], u[RAY_PACKET_SIZE], v[RAY_PACKET_SIZE];
+            int mask = packetHitsTriangle(pending, tri, pending.tMax, RAY_CULL_NONE, t, u, v) & active;
+            for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+                if (!(mask >> i & 1) || tri.face == pending.skipFace[i]) continue;
+                occluded |= 1 << i;
+                active &= ~(1 << i);
+                pending.disable(i);
+            }
+        }
+    }
+    return occluded;
+}
+
+#endif
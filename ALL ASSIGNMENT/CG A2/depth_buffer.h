@@ -0,0 +1,76 @@
+// Depth buffer with a coarse hierarchical-Z level for early rejection.
+// Smaller depth is closer; a fragment passes when its depth is less than the
+// stored one. Every 8x8 tile keeps the minimum and maximum depth stored in it:
+// a triangle whose nearest depth is not in front of a tile's farthest depth
+// cannot change that tile and is skipped without per-pixel work, and a
+// triangle entirely in front of a tile's nearest depth skips the depth test.
+// A buffer can cover only a band of image rows starting at a tile boundary;
+// it is still addressed with image coordinates.
+#ifndef DEPTH_BUFFER_H
+#define DEPTH_BUFFER_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "framebuffer.h"
+
+const int DEPTH_TILE_SHIFT = 3;
+const int DEPTH_TILE_SIZE = 1 << DEPTH_TILE_SHIFT;
+
+struct DepthBuffer {
+    Framebuffer<Depth32F> depth; // Its first row must be a multiple of DEPTH_TILE_SIZE
+    int tilesX = 0, tilesY = 0;
+    std::vector<float> tileMin, tileMax; // Nearest and farthest depth stored in each tile
+
+    // Counters of the work skipped by the hierarchical test
+    long long trianglesRejected = 0;
+    long long tilesRejected = 0;
+
+    void resize(int width, int height, int firstRow = 0) {
+        depth.resize(width, height, firstRow);
+        tilesX = (width + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+        tilesY = (height + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+        tileMin.resize(static_cast<size_t>(tilesX) * tilesY);
+        tileMax.resize(static_cast<size_t>(tilesX) * tilesY);
+    }
+
+    // Reset every pixel to the far plane (infinitely far away)
+    void clear() {
+        const float far = std::numeric_limits<float>::infinity();
+        depth.clear(far);
+        std::fill(tileMin.begin(), tileMin.end(), far);
+        std::fill(tileMax.begin(), tileMax.end(), far);
+        trianglesRejected = tilesRejected = 0;
+    }
+
+    int tileIndex(int tx, int ty) const { return (ty - (depth.originY >> DEPTH_TILE_SHIFT)) * tilesX + tx; }
+
+    // True when no tile overlapped by the box [x0, x1] x [y0, y1] can be changed by depth minZ
+    bool occluded(int x0, int y0, int x1, int y1, float minZ) const {
+        for (int ty = y0 >> DEPTH_TILE_SHIFT; ty <= (y1 >> DEPTH_TILE_SHIFT); ++ty) {
+            for (int tx = x0 >> DEPTH_TILE_SHIFT; tx <= (x1 >> DEPTH_TILE_SHIFT); ++tx) {
+                if (minZ < tileMax[tileIndex(tx, ty)]) return false;
+            }
+        }
+        return true;
+    }
+
+    // Recompute the depth range of a tile after pixels in it were written
+    void updateTile(int tx, int ty) {
+        int x0 = tx << DEPTH_TILE_SHIFT, x1 = std::min(depth.width, x0 + DEPTH_TILE_SIZE);
+        int y0 = ty << DEPTH_TILE_SHIFT, y1 = std::min(depth.originY + depth.height, y0 + DEPTH_TILE_SIZE);
+        float nearest = std::numeric_limits<float>::infinity(), farthest = -nearest;
+        for (int y = y0; y < y1; ++y) {
+            const float* row = depth.row(y);
+            for (int x = x0; x < x1; ++x) {
+                nearest = std::min(nearest, row[x]);
+                farthest = std::max(farthest, row[x]);
+            }
+        }
+        tileMin[tileIndex(tx, ty)] = nearest;
+        tileMax[tileIndex(tx, ty)] = farthest;
+    }
+};
+
+#endif
@@ -0,0 +1,82 @@
+// Bounded queue of face batches between one producer (the parser) and several
+// consumers (the raster threads). Every consumer sees every batch, in the
+// order it was written; a batch slot is reused once all consumers are done
+// with it, so the producer blocks while the slowest consumer is a full queue
+// behind and memory stays bounded however long the face list is.
+#ifndef FACE_QUEUE_H
+#define FACE_QUEUE_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+#include "mesh_io.h"
+
+struct FaceBatch {
+    std::vector<Face> faces; // Storage for a full batch
+    uint32_t count = 0;      // Faces actually in the batch
+};
+
+class FaceBatchQueue {
+public:
+    FaceBatchQueue(int capacity, int consumers, uint32_t batchSize)
+        : slots(static_cast<size_t>(capacity)), consumed(static_cast<size_t>(consumers), 0) {
+        for (FaceBatch& slot : slots) slot.faces.resize(batchSize);
+    }
+
+    // Producer: wait for a free slot and return it to be filled
+    FaceBatch& beginWrite() {
+        std::unique_lock<std::mutex> lock(mutex);
+        slotFreed.wait(lock, [this] { return produced - slowestConsumer() < slots.size(); });
+        return slots[produced % slots.size()];
+    }
+
+    // Producer: publish the slot returned by beginWrite
+    void endWrite() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            produced++;
+        }
+        batchReady.notify_all();
+    }
+
+    // Producer: no more batches will be written
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        batchReady.notify_all();
+    }
+
+    // Consumer: wait for the next batch; nullptr once the queue is closed and drained
+    const FaceBatch* beginRead(int consumer) {
+        std::unique_lock<std::mutex> lock(mutex);
+        batchReady.wait(lock, [&] { return consumed[consumer] < produced || closed; });
+        if (consumed[consumer] == produced) return nullptr;
+        return &slots[consumed[consumer] % slots.size()];
+    }
+
+    // Consumer: release the batch returned by beginRead
+    void endRead(int consumer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            consumed[consumer]++;
+        }
+        slotFreed.notify_one();
+    }
+
+private:
+    uint64_t slowestConsumer() const { return *std::min_element(consumed.begin(), consumed.end()); }
+
+    std::vector<FaceBatch> slots;
+    std::vector<uint64_t> consumed; // Batches finished by each consumer
+    uint64_t produced = 0;          // Batches written
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable batchReady, slotFreed;
+};
+
+#endif
@@ -0,0 +1,102 @@
+// Fragment lists of fixed size (a k-buffer) for blending translucent faces
+// independently of the order they are drawn in. A buffer covers one square
+// tile of the image: every pixel of the tile keeps its FRAGMENT_LIST_SIZE
+// nearest translucent fragments, sorted from near to far, and the resolve
+// blends them back to front over the opaque color already in the image.
+//
+// Fragments are ordered by depth, then by a per-face order key, so the same
+// set of nearest fragments is kept whatever order the faces arrive in. When a
+// pixel is covered by more translucent fragments than its list holds, the
+// farthest ones are dropped and counted.
+//
+// Memory stays bounded by the tile, not the image: each raster thread owns one
+// buffer and reuses it for every tile it resolves.
+#ifndef FRAGMENT_BUFFER_H
+#define FRAGMENT_BUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "framebuffer.h"
+
+const int FRAGMENT_TILE_SHIFT = 5;
+const int FRAGMENT_TILE_SIZE = 1 << FRAGMENT_TILE_SHIFT; // Pixels per side of a tile
+const int FRAGMENT_LIST_SIZE = 8;                        // Fragments kept per pixel
+
+// One translucent fragment: its depth, the order key of its face (smaller is
+// nearer between fragments of equal depth) and its RGBA8 color with opacity
+struct Fragment {
+    float z;
+    uint32_t order;
+    uint32_t color;
+};
+
+struct FragmentTile {
+    int x0 = 0, y0 = 0; // Image position of the tile's first pixel
+    std::vector<uint8_t> count;      // Fragments held by each pixel
+    std::vector<Fragment> fragments; // FRAGMENT_LIST_SIZE per pixel, nearest first
+    long long stored = 0, dropped = 0; // Fragments inserted and dropped beyond a full list
+
+    FragmentTile()
+        : count(FRAGMENT_TILE_SIZE * FRAGMENT_TILE_SIZE),
+          fragments(FRAGMENT_TILE_SIZE * FRAGMENT_TILE_SIZE * FRAGMENT_LIST_SIZE) {}
+
+    // Function to empty the lists and move the buffer to the tile starting at (x, y)
+    void reset(int x, int y) {
+        x0 = x;
+        y0 = y;
+        std::memset(count.data(), 0, count.size());
+    }
+
+    static bool nearer(const Fragment& a, const Fragment& b) {
+        return a.z < b.z || (a.z == b.z && a.order < b.order);
+    }
+
+    // Function to add a fragment to the list of image pixel (x, y) of the tile
+    void insert(int x, int y, const Fragment& fragment) {
+        int pixel = (y - y0) * FRAGMENT_TILE_SIZE + (x - x0);
+        Fragment* list = &fragments[static_cast<size_t>(pixel) * FRAGMENT_LIST_SIZE];
+        int n = count[pixel];
+        stored++;
+        if (n == FRAGMENT_LIST_SIZE) {
+            dropped++;
+            if (!nearer(fragment, list[n - 1])) return; // Farther than everything kept
+            n--; // Make room by dropping the farthest
+        }
+        int i = n;
+        for (; i > 0 && nearer(fragment, list[i - 1]); --i) list[i] = list[i - 1];
+        list[i] = fragment;
+        count[pixel] = static_cast<uint8_t>(n + 1);
+    }
+
+    // Function to blend the fragments of every pixel, farthest first, over the
+    // image pixels of the tile (clipped to the image)
+    template <typename Format>
+    void resolve(Framebuffer<Format>& image) const {
+        int x1 = std::min(x0 + FRAGMENT_TILE_SIZE, image.width);
+        int y1 = std::min(y0 + FRAGMENT_TILE_SIZE, image.originY + image.height);
+        for (int y = y0; y < y1; ++y) {
+            typename Format::Pixel* row = image.row(y);
+            for (int x = x0; x < x1; ++x) {
+                int pixel = (y - y0) * FRAGMENT_TILE_SIZE + (x - x0);
+                int n = count[pixel];
+                if (n == 0) continue;
+                const Fragment* list = &fragments[static_cast<size_t>(pixel) * FRAGMENT_LIST_SIZE];
+                int rgb[3];
+                Format::unpack(row[x], rgb);
+                float color[3] = { float(rgb[0]), float(rgb[1]), float(rgb[2]) };
+                for (int i = n - 1; i >= 0; --i) {
+                    uint32_t c = list[i].color;
+                    float alpha = (c >> 24) / 255.0f;
+                    for (int j = 0; j < 3; ++j) color[j] += (((c >> (8 * j)) & 0xFF) - color[j]) * alpha;
+                }
+                row[x] = Format::pack(static_cast<int>(color[0] + 0.5f), static_cast<int>(color[1] + 0.5f),
+                                      static_cast<int>(color[2] + 0.5f));
+            }
+        }
+    }
+};
+
+#endif
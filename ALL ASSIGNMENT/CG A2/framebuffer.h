@@ -0,0 +1,132 @@
+// Framebuffer used by the rasterizer, templated on the pixel format.
+// A pixel format describes how one pixel is stored and how it is converted
+// to and from the 0-255 integer RGB values used by the mesh files.
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// Clamp a color channel to the 8-bit range
+inline uint8_t clampChannel(int value) {
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// 3 bytes per pixel, laid out exactly as the pixel data of a binary P6 file
+struct RGB8 {
+    struct Pixel {
+        uint8_t r, g, b;
+    };
+    static const bool rawRGB = true; // Rows can be written to a P6 file as they are
+
+    static Pixel pack(int r, int g, int b) {
+        return Pixel{ clampChannel(r), clampChannel(g), clampChannel(b) };
+    }
+    static void unpack(const Pixel& p, int* rgb) {
+        rgb[0] = p.r;
+        rgb[1] = p.g;
+        rgb[2] = p.b;
+    }
+};
+
+// 4 bytes per pixel packed into one 32-bit word (R in the low byte, A in the high byte)
+struct RGBA8 {
+    typedef uint32_t Pixel;
+    static const bool rawRGB = false;
+
+    static Pixel pack(int r, int g, int b, int a = 255) {
+        return static_cast<uint32_t>(clampChannel(r))
+             | static_cast<uint32_t>(clampChannel(g)) << 8
+             | static_cast<uint32_t>(clampChannel(b)) << 16
+             | static_cast<uint32_t>(clampChannel(a)) << 24;
+    }
+    static void unpack(Pixel p, int* rgb) {
+        rgb[0] = p & 0xFF;
+        rgb[1] = (p >> 8) & 0xFF;
+        rgb[2] = (p >> 16) & 0xFF;
+    }
+};
+
+// Floating-point accumulation buffer (12 bytes per pixel), for blending and resolves
+struct RGBF32 {
+    struct Pixel {
+        float r, g, b;
+    };
+    static const bool rawRGB = false;
+
+    static Pixel pack(int r, int g, int b) {
+        return Pixel{ static_cast<float>(r), static_cast<float>(g), static_cast<float>(b) };
+    }
+    static void unpack(const Pixel& p, int* rgb) {
+        rgb[0] = clampChannel(static_cast<int>(p.r + 0.5f));
+        rgb[1] = clampChannel(static_cast<int>(p.g + 0.5f));
+        rgb[2] = clampChannel(static_cast<int>(p.b + 0.5f));
+    }
+};
+
+// 32-bit float depth, for depth buffers (not a color format)
+struct Depth32F {
+    typedef float Pixel;
+};
+
+// 32-bit counter per pixel, e.g. how often each pixel was shaded (not a color format)
+struct Count32 {
+    typedef uint32_t Pixel;
+};
+
+// 32-bit index of the face that produced each pixel (not a color format)
+struct FaceId32 {
+    typedef uint32_t Pixel;
+};
+
+// Barycentric weights of the second and third vertex as 16-bit fractions in the
+// low and high half of each pixel (not a color format)
+struct Barycentric16x2 {
+    typedef uint32_t Pixel;
+};
+
+// Row-major image of width * height pixels of the given format. A buffer can
+// also hold a band of rows of a larger image, starting at row originY; rows are
+// always addressed with image coordinates.
+template <typename Format>
+struct Framebuffer {
+    typedef typename Format::Pixel Pixel;
+
+    int width = 0, height = 0;
+    int originY = 0; // Image row stored first
+    std::vector<Pixel> pixels;
+
+    Framebuffer() {}
+    Framebuffer(int w, int h) { resize(w, h); }
+
+    // Reallocate only when the size changes, so a buffer can be reused between frames and bands
+    void resize(int w, int h, int firstRow = 0) {
+        width = w;
+        height = h;
+        originY = firstRow;
+        pixels.resize(static_cast<size_t>(w) * h);
+    }
+
+    Pixel* row(int y) { return pixels.data() + static_cast<size_t>(y - originY) * width; }
+    const Pixel* row(int y) const { return pixels.data() + static_cast<size_t>(y - originY) * width; }
+
+    void clear(Pixel value = Pixel()) { std::fill(pixels.begin(), pixels.end(), value); }
+
+    void store(int x, int y, Pixel value) { row(y)[x] = value; }
+
+    // Fill pixels [x0, x1] of row y with one value
+    void fillSpan(int y, int x0, int x1, Pixel value) {
+        Pixel* p = row(y);
+        std::fill(p + x0, p + x1 + 1, value);
+    }
+};
+
+// Pixel format used by the renderer unless another one is requested at compile time
+#ifdef BARYCEN_RGBA8
+typedef RGBA8 DefaultFormat;
+#else
+typedef RGB8 DefaultFormat;
+#endif
+
+#endif
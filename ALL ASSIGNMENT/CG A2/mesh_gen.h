@@ -0,0 +1,391 @@
+// Procedural meshes for benchmarking the renderer, generated reproducibly from
+// a shape, a face count, an image size and a seed:
+//
+//   geosphere  subdivided icosahedron seen from the front, with depth; an
+//              icosahedron split at frequency f has 20 f^2 faces and every
+//              vertex is shared by its neighbouring faces
+//   grid       image-filling grid of cells, each split into two triangles
+//   soup       independent triangles of random position, orientation and size
+//   slivers    independent long, thin triangles of random position, direction
+//              and length
+//
+// Sizes of soup triangles and lengths of slivers are drawn from a range in
+// pixels, uniformly or log-uniformly (as many triangles of 2-4 pixels as of
+// 32-64). Random numbers come from a SplitMix64 generator converted to floats
+// here rather than by the standard library's distributions, whose results
+// differ between implementations, so a seed names the same mesh everywhere.
+#ifndef MESH_GEN_H
+#define MESH_GEN_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "mesh_io.h"
+
+enum MeshShape {
+    SHAPE_GEOSPHERE,
+    SHAPE_GRID,
+    SHAPE_SOUP,
+    SHAPE_SLIVERS
+};
+
+enum SizeDistribution {
+    SIZE_UNIFORM,
+    SIZE_LOG_UNIFORM
+};
+
+struct MeshGenOptions {
+    MeshShape shape = SHAPE_GEOSPHERE;
+    uint64_t faces = 1000;       // Geospheres and grids get the closest face count they can make
+    int width = 1024, height = 1024;
+    uint64_t seed = 1;
+    double minSize = 4, maxSize = 64; // Soup triangle size and sliver length range in pixels
+    SizeDistribution distribution = SIZE_LOG_UNIFORM;
+    double sliverWidth = 1;      // Distance of a sliver's apex from its long side in pixels
+    bool depth = false;          // Give grids, soups and slivers per-vertex depth (geospheres always have it)
+    bool texcoords = false;      // Give every vertex texture coordinates
+    int opacity = 255;           // Opacity of every vertex, 0-255; faces below 255 are blended
+};
+
+// SplitMix64 random numbers
+struct MeshRandom {
+    uint64_t state;
+
+    explicit MeshRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, 1), from the top 53 bits
+    double uniform() { return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0); }
+    double uniform(double lo, double hi) { return lo + (hi - lo) * uniform(); }
+
+    uint32_t color() {
+        uint64_t bits = next();
+        return RGBA8::pack(static_cast<int>(bits & 0xFF), static_cast<int>((bits >> 8) & 0xFF), static_cast<int>((bits >> 16) & 0xFF));
+    }
+};
+
+const double MESH_GEN_PI = 3.14159265358979323846;
+
+// Function to draw a triangle size from the range and distribution of the options
+inline double sampleTriangleSize(MeshRandom& random, const MeshGenOptions& options) {
+    if (options.distribution == SIZE_LOG_UNIFORM) {
+        return options.minSize * std::exp(random.uniform() * std::log(options.maxSize / options.minSize));
+    }
+    return random.uniform(options.minSize, options.maxSize);
+}
+
+// Function to size the vertex arrays of a mesh for the attributes of the options
+inline void allocateGeneratedMesh(Mesh& mesh, const MeshGenOptions& options, size_t numVertices, size_t numFaces, bool depth) {
+    mesh = Mesh();
+    mesh.width = options.width;
+    mesh.height = options.height;
+    mesh.x.resize(numVertices);
+    mesh.y.resize(numVertices);
+    if (depth) mesh.z.resize(numVertices);
+    if (options.texcoords) {
+        mesh.u.resize(numVertices);
+        mesh.v.resize(numVertices);
+    }
+    mesh.faces.resize(numFaces);
+}
+
+// Function to set vertex i at image position (x, y); texture coordinates, when
+// present, map the texture once over the whole image
+inline void setGeneratedVertex(Mesh& mesh, size_t i, double x, double y) {
+    mesh.x[i] = static_cast<int32_t>(std::lround(x));
+    mesh.y[i] = static_cast<int32_t>(std::lround(y));
+    if (!mesh.u.empty()) {
+        mesh.u[i] = static_cast<float>(x / mesh.width);
+        mesh.v[i] = static_cast<float>(y / mesh.height);
+    }
+}
+
+// Frequency f of the geosphere whose 20 f^2 faces come closest to options.faces
+inline uint64_t geosphereFrequency(const MeshGenOptions& options) {
+    return static_cast<uint64_t>(std::max<long long>(1, std::llround(std::sqrt(options.faces / 20.0))));
+}
+
+// Function to find the columns and rows of the grid whose cells come closest
+// to square and to options.faces triangles
+inline void gridSize(const MeshGenOptions& options, uint64_t& columns, uint64_t& rows) {
+    double cells = std::max(1.0, options.faces / 2.0);
+    columns = static_cast<uint64_t>(std::max<long long>(1, std::llround(std::sqrt(cells * options.width / options.height))));
+    rows = static_cast<uint64_t>(std::max<long long>(1, std::llround(cells / columns)));
+}
+
+// Function to count the vertices and faces generateMesh makes for the options
+inline void generatedMeshSize(const MeshGenOptions& options, uint64_t& numVertices, uint64_t& numFaces) {
+    numVertices = numFaces = 0;
+    switch (options.shape) {
+    case SHAPE_GEOSPHERE: {
+        uint64_t f = geosphereFrequency(options);
+        numVertices = 10 * f * f + 2;
+        numFaces = 20 * f * f;
+        break;
+    }
+    case SHAPE_GRID: {
+        uint64_t columns, rows;
+        gridSize(options, columns, rows);
+        numVertices = (columns + 1) * (rows + 1);
+        numFaces = 2 * columns * rows;
+        break;
+    }
+    case SHAPE_SOUP:
+    case SHAPE_SLIVERS:
+        numVertices = 3 * options.faces;
+        numFaces = options.faces;
+        break;
+    }
+}
+
+// Function to generate a subdivided icosahedron filling the image, at the
+// frequency whose 20 f^2 faces come closest to options.faces
+inline void generateGeosphere(const MeshGenOptions& options, Mesh& mesh) {
+    const double t = (1 + std::sqrt(5.0)) / 2;
+    const double corners[12][3] = { { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 }, { 0, -1, t }, { 0, 1, t },
+                                    { 0, -1, -t }, { 0, 1, -t }, { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 } };
+    const int triangles[20][3] = { { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+                                   { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+                                   { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+                                   { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+    const uint32_t f = static_cast<uint32_t>(geosphereFrequency(options));
+
+    // Number the 30 edges of the icosahedron
+    int edgeIndex[12][12];
+    int edgeEnds[30][2];
+    int numEdges = 0;
+    std::fill(&edgeIndex[0][0], &edgeIndex[0][0] + 144, -1);
+    for (const int* tri : triangles) {
+        for (int k = 0; k < 3; ++k) {
+            int a = std::min(tri[k], tri[(k + 1) % 3]), b = std::max(tri[k], tri[(k + 1) % 3]);
+            if (edgeIndex[a][b] >= 0) continue;
+            edgeIndex[a][b] = edgeIndex[b][a] = numEdges;
+            edgeEnds[numEdges][0] = a;
+            edgeEnds[numEdges][1] = b;
+            numEdges++;
+        }
+    }
+
+    // Vertices: the 12 corners, then f - 1 inside each edge, then the
+    // (f - 1)(f - 2) / 2 inside each face, 10 f^2 + 2 in all
+    const size_t edgeBase = 12, perEdge = f - 1;
+    const size_t faceBase = edgeBase + 30 * perEdge, perFace = static_cast<size_t>(f - 1) * (f > 1 ? f - 2 : 0) / 2;
+    const size_t numVertices = faceBase + 20 * perFace;
+    allocateGeneratedMesh(mesh, options, numVertices, static_cast<size_t>(20) * f * f, true);
+
+    // A point of the flat icosahedron is pushed out onto the sphere, which is
+    // drawn orthographically: x right, y up, the viewer on +z. Depth is
+    // 2 - z, from 1 at the front to 3 at the back, so it also works as a view
+    // distance with --perspective; the color is the normal mapped to RGB.
+    const double radius = 0.45 * std::min(options.width, options.height);
+    std::vector<uint32_t> colors(numVertices);
+    auto place = [&](size_t i, const double* a, const double* b, const double* c, double s, double r) {
+        double p[3];
+        for (int k = 0; k < 3; ++k) p[k] = a[k] + (b[k] - a[k]) * s + (c[k] - a[k]) * r;
+        double length = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        for (double& coordinate : p) coordinate /= length;
+        mesh.x[i] = static_cast<int32_t>(std::lround(options.width / 2.0 + radius * p[0]));
+        mesh.y[i] = static_cast<int32_t>(std::lround(options.height / 2.0 - radius * p[1]));
+        mesh.z[i] = static_cast<float>(2 - p[2]);
+        if (!mesh.u.empty()) {
+            mesh.u[i] = static_cast<float>(0.5 + std::atan2(p[0], p[2]) / (2 * MESH_GEN_PI));
+            mesh.v[i] = static_cast<float>(std::acos(std::max(-1.0, std::min(1.0, p[1]))) / MESH_GEN_PI);
+        }
+        colors[i] = RGBA8::pack(static_cast<int>(std::lround((p[0] + 1) * 127.5)), static_cast<int>(std::lround((p[1] + 1) * 127.5)),
+                                static_cast<int>(std::lround((p[2] + 1) * 127.5)));
+    };
+    for (int i = 0; i < 12; ++i) place(static_cast<size_t>(i), corners[i], corners[i], corners[i], 0, 0);
+    for (int e = 0; e < numEdges; ++e) {
+        const double* a = corners[edgeEnds[e][0]];
+        const double* b = corners[edgeEnds[e][1]];
+        for (uint32_t s = 1; s < f; ++s) place(edgeBase + e * perEdge + (s - 1), a, b, a, static_cast<double>(s) / f, 0);
+    }
+
+    // Vertex (i, j) of face n is at A + (B - A) i / f + (C - A) j / f, for
+    // corners A, B, C; interior vertices are stored row by row of j
+    auto edgeVertex = [&](int from, int to, uint32_t s) -> uint32_t {
+        int e = edgeIndex[from][to];
+        uint32_t along = from == edgeEnds[e][0] ? s : f - s; // Measured from the lower corner
+        return static_cast<uint32_t>(edgeBase + e * perEdge + (along - 1));
+    };
+    auto rowStart = [&](uint32_t j) { return static_cast<size_t>(j - 1) * (f - 1) - static_cast<size_t>(j - 1) * j / 2; };
+    size_t faceCount = 0;
+    for (int n = 0; n < 20; ++n) {
+        const int a = triangles[n][0], b = triangles[n][1], c = triangles[n][2];
+        const size_t interior = faceBase + n * perFace;
+        for (uint32_t j = 1; j + 1 < f; ++j) {
+            for (uint32_t i = 1; i + j < f; ++i) {
+                place(interior + rowStart(j) + (i - 1), corners[a], corners[b], corners[c], static_cast<double>(i) / f, static_cast<double>(j) / f);
+            }
+        }
+        auto vertexAt = [&](uint32_t i, uint32_t j) -> uint32_t {
+            if (i == 0 && j == 0) return static_cast<uint32_t>(a);
+            if (i == f) return static_cast<uint32_t>(b);
+            if (j == f) return static_cast<uint32_t>(c);
+            if (j == 0) return edgeVertex(a, b, i);
+            if (i == 0) return edgeVertex(a, c, j);
+            if (i + j == f) return edgeVertex(b, c, j);
+            return static_cast<uint32_t>(interior + rowStart(j) + (i - 1));
+        };
+        auto emit = [&](uint32_t v1, uint32_t v2, uint32_t v3) {
+            Face& face = mesh.faces[faceCount++];
+            face.v1 = v1;
+            face.v2 = v2;
+            face.v3 = v3;
+            face.colors[0] = colors[v1];
+            face.colors[1] = colors[v2];
+            face.colors[2] = colors[v3];
+        };
+        for (uint32_t j = 0; j < f; ++j) {
+            for (uint32_t i = 0; i + j < f; ++i) {
+                emit(vertexAt(i, j), vertexAt(i + 1, j), vertexAt(i, j + 1));
+                if (i + j + 1 < f) emit(vertexAt(i + 1, j), vertexAt(i + 1, j + 1), vertexAt(i, j + 1));
+            }
+        }
+    }
+}
+
+// Function to generate a grid of cells covering the image, as close to square
+// cells and to options.faces triangles as whole rows and columns allow
+inline void generateGrid(const MeshGenOptions& options, Mesh& mesh) {
+    MeshRandom random(options.seed);
+    uint64_t gridColumns, gridRows;
+    gridSize(options, gridColumns, gridRows);
+    const uint32_t columns = static_cast<uint32_t>(gridColumns), rows = static_cast<uint32_t>(gridRows);
+    const size_t stride = static_cast<size_t>(columns) + 1;
+    allocateGeneratedMesh(mesh, options, stride * (rows + 1), static_cast<size_t>(2) * columns * rows, options.depth);
+
+    // Depth is a gentle ripple of random phase between 1 and 2
+    double phaseX = random.uniform(0, 2 * MESH_GEN_PI), phaseY = random.uniform(0, 2 * MESH_GEN_PI);
+    std::vector<uint32_t> colors(mesh.x.size());
+    for (uint32_t j = 0; j <= rows; ++j) {
+        for (uint32_t i = 0; i <= columns; ++i) {
+            size_t index = j * stride + i;
+            setGeneratedVertex(mesh, index, static_cast<double>(i) * (options.width - 1) / columns,
+                               static_cast<double>(j) * (options.height - 1) / rows);
+            if (!mesh.z.empty()) {
+                mesh.z[index] = static_cast<float>(1.5 + 0.25 * std::sin(4 * MESH_GEN_PI * i / columns + phaseX)
+                                                       + 0.25 * std::sin(4 * MESH_GEN_PI * j / rows + phaseY));
+            }
+            colors[index] = random.color();
+        }
+    }
+
+    Face* face = mesh.faces.data();
+    for (uint32_t j = 0; j < rows; ++j) {
+        for (uint32_t i = 0; i < columns; ++i) {
+            uint32_t v00 = static_cast<uint32_t>(j * stride + i), v10 = v00 + 1;
+            uint32_t v01 = static_cast<uint32_t>(v00 + stride), v11 = v01 + 1;
+            *face++ = Face{ v00, v10, v01, { colors[v00], colors[v10], colors[v01] } };
+            *face++ = Face{ v10, v11, v01, { colors[v10], colors[v11], colors[v01] } };
+        }
+    }
+}
+
+// Function to generate options.faces independent triangles, each with its own
+// three vertices: a random triangle of the chosen size anywhere in the image
+// (soup), or a long side of the chosen length with its apex options.sliverWidth
+// away (slivers). Depth, when asked for, is random per triangle between 1 and 3
+// with a slight random slope.
+inline void generateSoup(const MeshGenOptions& options, Mesh& mesh) {
+    MeshRandom random(options.seed);
+    const size_t numFaces = static_cast<size_t>(options.faces);
+    allocateGeneratedMesh(mesh, options, 3 * numFaces, numFaces, options.depth);
+
+    for (size_t n = 0; n < numFaces; ++n) {
+        double centerX = random.uniform(0, options.width), centerY = random.uniform(0, options.height);
+        double size = sampleTriangleSize(random, options);
+        double angle = random.uniform(0, 2 * MESH_GEN_PI);
+        double px[3], py[3];
+        if (options.shape == SHAPE_SLIVERS) {
+            double dx = std::cos(angle), dy = std::sin(angle);
+            double apex = random.uniform(-0.5, 0.5) * size;
+            px[0] = centerX - dx * size / 2;
+            py[0] = centerY - dy * size / 2;
+            px[1] = centerX + dx * size / 2;
+            py[1] = centerY + dy * size / 2;
+            px[2] = centerX + dx * apex - dy * options.sliverWidth;
+            py[2] = centerY + dy * apex + dx * options.sliverWidth;
+        } else {
+            for (int k = 0; k < 3; ++k) { // Corners around the center, jittered in angle and distance
+                double a = angle + k * (2 * MESH_GEN_PI / 3) + random.uniform(-0.5, 0.5);
+                double r = size / 2 * random.uniform(0.5, 1);
+                px[k] = centerX + r * std::cos(a);
+                py[k] = centerY + r * std::sin(a);
+            }
+        }
+
+        size_t first = 3 * n;
+        double depth = random.uniform(1, 3), slopeX = random.uniform(-1, 1) * 0.001, slopeY = random.uniform(-1, 1) * 0.001;
+        Face& face = mesh.faces[n];
+        for (int k = 0; k < 3; ++k) {
+            setGeneratedVertex(mesh, first + k, px[k], py[k]);
+            if (!mesh.z.empty()) mesh.z[first + k] = static_cast<float>(depth + slopeX * (px[k] - centerX) + slopeY * (py[k] - centerY));
+            face.colors[k] = random.color();
+        }
+        face.v1 = static_cast<uint32_t>(first);
+        face.v2 = static_cast<uint32_t>(first + 1);
+        face.v3 = static_cast<uint32_t>(first + 2);
+    }
+}
+
+// Function to generate the mesh described by the options; on failure returns false and sets error
+inline bool generateMesh(const MeshGenOptions& options, Mesh& mesh, std::string& error) {
+    if (options.width <= 0 || options.height <= 0) {
+        error = "image size must be positive";
+        return false;
+    }
+    if (options.opacity < 0 || options.opacity > 255) {
+        error = "opacity must be between 0 and 255";
+        return false;
+    }
+    if (options.minSize <= 0 || options.maxSize < options.minSize || options.sliverWidth < 0) {
+        error = "triangle sizes must be positive, the smallest first";
+        return false;
+    }
+    // The text format counts vertices and faces in int, with room for 1-based indices
+    const uint64_t maxFaces = options.shape == SHAPE_SOUP || options.shape == SHAPE_SLIVERS ? 0x7FFFFFFEull / 3 : 0x7FFFFFFEull / 5;
+    if (options.faces > maxFaces) {
+        error = "at most " + std::to_string(maxFaces) + " faces can be generated for this shape";
+        return false;
+    }
+    // Faces store 32-bit vertex indices; rounding to whole grid rows and columns can add faces
+    uint64_t numVertices, numFaces;
+    generatedMeshSize(options, numVertices, numFaces);
+    if (numVertices > UINT32_MAX || numFaces > UINT32_MAX) {
+        error = "these options make " + std::to_string(numVertices) + " vertices and " + std::to_string(numFaces) +
+                " faces, more than 32-bit vertex indices can address";
+        return false;
+    }
+
+    switch (options.shape) {
+    case SHAPE_GEOSPHERE:
+        generateGeosphere(options, mesh);
+        break;
+    case SHAPE_GRID:
+        generateGrid(options, mesh);
+        break;
+    case SHAPE_SOUP:
+    case SHAPE_SLIVERS:
+        generateSoup(options, mesh);
+        break;
+    }
+    if (options.opacity < 255) {
+        const uint32_t alpha = static_cast<uint32_t>(options.opacity) << 24;
+        for (Face& face : mesh.faces) {
+            for (uint32_t& color : face.colors) color = (color & 0xFFFFFFu) | alpha;
+        }
+    }
+    return true;
+}
+
+#endif
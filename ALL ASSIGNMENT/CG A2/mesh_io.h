@@ -0,0 +1,716 @@
+// Mesh data structures and loading of the text mesh format:
+//
+//   # comments and blank lines are allowed anywhere
+//   <width> <height>
+//   <number of vertices> [z] [uv]
+//   <x> <y> [<z>] [<u> <v>]                  (one line per vertex)
+//   <number of faces> [rgba]
+//   <v1> <v2> <v3> <r1 g1 b1 r2 g2 b2 r3 g3 b3>   (1-based indices, one line per face)
+//
+// Writing "z" after the vertex count declares a depth value on every vertex
+// line (smaller z is closer to the viewer), and "uv" declares texture
+// coordinates (0-1 across the texture). Writing "rgba" after the face count
+// gives every corner an opacity after its color (r g b a, 0 transparent to
+// 255 opaque), 12 color values per face line. Values after the ones listed
+// are ignored, so lines carrying a stray extra color value are accepted. The
+// file is memory-mapped and numbers are converted with std::from_chars,
+// without building a stream per line.
+//
+// The same mesh can also be stored in a binary container (.bmesh) whose
+// arrays have exactly the in-memory layout used by the renderer, so a
+// mapped file is rendered in place without any deserialization.
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+
+#include "framebuffer.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Structure to store vertex information (x, y coordinates, optional depth and texture coordinates)
+struct Vertex {
+    int x, y;
+    float z;
+    float u, v;
+};
+
+// Structure to store face information (triangle defined by 3 vertices and their colors)
+struct Face {
+    uint32_t v1, v2, v3; // Vertex indices (0-based; the text format is 1-based)
+    uint32_t colors[3];  // Color of each vertex, packed like an RGBA8 pixel
+};
+
+// Non-owning view of a mesh; this is all the renderer needs. Vertex
+// coordinates are stored structure-of-arrays.
+struct MeshView {
+    int width = 0, height = 0;
+    uint32_t numVertices = 0, numFaces = 0;
+    const int32_t* x = nullptr;
+    const int32_t* y = nullptr;
+    const float* z = nullptr; // Per-vertex depth, nullptr for flat 2D meshes
+    const float* u = nullptr; // Per-vertex texture coordinates, nullptr when untextured
+    const float* v = nullptr;
+    const Face* faces = nullptr;
+    const float* w = nullptr; // View distance of each vertex when projected by a camera
+    float nearZ = 0;          // Projected triangles with a vertex closer than this are culled
+
+    Vertex vertex(uint32_t index) const {
+        return Vertex{ x[index], y[index], z ? z[index] : 0.0f, u ? u[index] : 0.0f, v ? v[index] : 0.0f };
+    }
+};
+
+// A mesh held in memory: image size, vertex list and face list
+struct Mesh {
+    int width = 0, height = 0;
+    std::vector<int32_t> x, y;
+    std::vector<float> z; // Empty unless the vertex list carries depth
+    std::vector<float> u, v; // Empty unless the vertex list carries texture coordinates
+    std::vector<Face> faces;
+
+    MeshView view() const {
+        MeshView mesh;
+        mesh.width = width;
+        mesh.height = height;
+        mesh.numVertices = static_cast<uint32_t>(x.size());
+        mesh.numFaces = static_cast<uint32_t>(faces.size());
+        mesh.x = x.data();
+        mesh.y = y.data();
+        mesh.z = z.empty() ? nullptr : z.data();
+        mesh.u = u.empty() ? nullptr : u.data();
+        mesh.v = v.empty() ? nullptr : v.data();
+        mesh.faces = faces.data();
+        return mesh;
+    }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) { close(); return false; }
+        length = static_cast<size_t>(fileSize.QuadPart);
+        if (length == 0) return true; // Empty files cannot be mapped
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) { close(); return false; }
+        bytes = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (bytes == nullptr) { close(); return false; }
+#else
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) { close(); return false; }
+        length = static_cast<size_t>(info.st_size);
+        if (length == 0) return true; // Empty files cannot be mapped
+        void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) { close(); return false; }
+        bytes = static_cast<const char*>(address);
+        madvise(address, length, MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Line-oriented cursor over the text of a mesh file
+struct MeshTextCursor {
+    const char* p;
+    const char* end;
+    int line = 0;      // 1-based number of the current line
+    std::string error; // Set when a read fails
+
+    MeshTextCursor(const char* begin = nullptr, const char* finish = nullptr) : p(begin), end(finish) {}
+
+    // Move to the start of the next line holding data, skipping blank and comment lines
+    bool nextDataLine() {
+        while (p < end) {
+            ++line;
+            const char* q = p;
+            while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) ++q;
+            if (q < end && *q != '\n' && *q != '#') {
+                p = q;
+                return true;
+            }
+            skipRestOfLine();
+        }
+        return false;
+    }
+
+    // Move past the end of the current line
+    void skipRestOfLine() {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        p = newline ? newline + 1 : end;
+    }
+
+    // Read one integer from the current line
+    bool readInt(int& value, const char* what) {
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || (result.ptr < end && !isSeparator(*result.ptr))) {
+            return fail(std::string("expected ") + what);
+        }
+        p = result.ptr;
+        return true;
+    }
+
+    // Read one decimal number ([+-]digits[.digits][e[+-]digits]) from the current line
+    bool readFloat(float& value, const char* what) {
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        const char* q = p < end && *p == '+' ? p + 1 : p; // from_chars takes no plus sign
+        const char* first = q < end && *q == '-' && q == p ? q + 1 : q;
+        if (first >= end || !((*first >= '0' && *first <= '9') || *first == '.')) { // Nor inf or nan
+            return fail(std::string("expected ") + what);
+        }
+        float parsed = 0;
+        std::from_chars_result result = std::from_chars(q, end, parsed);
+        if (result.ec == std::errc::result_out_of_range) {
+            // Values too small for a float become zero; too large ones are an error.
+            // Beyond even a double, the exponent's sign or else the integer part tells
+            double wide = 0;
+            bool tiny;
+            if (std::from_chars(q, end, wide).ec == std::errc()) {
+                tiny = std::fabs(wide) < 1;
+            } else {
+                const char* e = std::find_if(q, result.ptr, [](char c) { return c == 'e' || c == 'E'; });
+                const char* digits = *q == '-' ? q + 1 : q;
+                tiny = e != result.ptr ? e[1] == '-'
+                                       : std::all_of(digits, std::find(digits, e, '.'), [](char c) { return c == '0'; });
+            }
+            if (!tiny) return fail(std::string(what) + " out of range");
+            parsed = *q == '-' ? -0.0f : 0.0f;
+            result.ec = std::errc();
+        }
+        if (result.ec != std::errc() || (result.ptr < end && !isSeparator(*result.ptr))) {
+            return fail(std::string("expected ") + what);
+        }
+        value = parsed;
+        p = result.ptr;
+        return true;
+    }
+
+    // Read the next whitespace-separated word of the current line; returns false at the end of the line
+    bool readWord(std::string& word) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        const char* start = p;
+        while (p < end && !isSeparator(*p)) ++p;
+        word.assign(start, p);
+        return !word.empty();
+    }
+
+    bool fail(const std::string& message) {
+        error = line > 0 ? "line " + std::to_string(line) + ": " + message : message;
+        return false;
+    }
+
+    static bool isSeparator(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+};
+
+// Function to parse the image size, the vertex list and the face count of a
+// mesh file, leaving the cursor at the first face; alpha is set when the face
+// lines carry opacities. On failure sets in.error
+inline bool parseMeshHeader(MeshTextCursor& in, Mesh& mesh, int& numFaces, bool& alpha) {
+    // Image size
+    if (!in.nextDataLine()) return in.fail("missing image size");
+    if (!in.readInt(mesh.width, "image width") || !in.readInt(mesh.height, "image height")) return false;
+    if (mesh.width <= 0 || mesh.height <= 0) return in.fail("image size must be positive");
+    in.skipRestOfLine();
+
+    // Vertex list
+    int numVertices = 0;
+    if (!in.nextDataLine()) return in.fail("missing vertex count");
+    if (!in.readInt(numVertices, "vertex count")) return false;
+    if (numVertices < 0) return in.fail("negative vertex count");
+    bool hasZ = false, hasUV = false;
+    std::string tag;
+    while (in.readWord(tag)) { // Attribute tags after the count
+        if (tag[0] == '#') break; // Trailing comment
+        if (tag == "z") {
+            hasZ = true;
+        } else if (tag == "uv") {
+            hasUV = true;
+        } else {
+            return in.fail("unknown vertex attribute '" + tag + "'");
+        }
+    }
+    in.skipRestOfLine();
+    mesh.x.resize(static_cast<size_t>(numVertices));
+    mesh.y.resize(static_cast<size_t>(numVertices));
+    if (hasZ) mesh.z.resize(static_cast<size_t>(numVertices));
+    if (hasUV) {
+        mesh.u.resize(static_cast<size_t>(numVertices));
+        mesh.v.resize(static_cast<size_t>(numVertices));
+    }
+    for (int i = 0; i < numVertices; ++i) {
+        if (!in.nextDataLine()) return in.fail("unexpected end of file in vertex list");
+        if (!in.readInt(mesh.x[i], "vertex x") || !in.readInt(mesh.y[i], "vertex y")) return false;
+        if (hasZ && !in.readFloat(mesh.z[i], "vertex z")) return false;
+        if (hasUV && (!in.readFloat(mesh.u[i], "vertex u") || !in.readFloat(mesh.v[i], "vertex v"))) return false;
+        in.skipRestOfLine();
+    }
+
+    // Face count
+    if (!in.nextDataLine()) return in.fail("missing face count");
+    if (!in.readInt(numFaces, "face count")) return false;
+    if (numFaces < 0) return in.fail("negative face count");
+    alpha = false;
+    while (in.readWord(tag)) { // Attribute tags after the count
+        if (tag[0] == '#') break;
+        if (tag == "rgba") {
+            alpha = true;
+        } else {
+            return in.fail("unknown face attribute '" + tag + "'");
+        }
+    }
+    in.skipRestOfLine();
+    return true;
+}
+
+// Function to parse the next face line, with an opacity after every corner's
+// color when alpha is set; on failure sets in.error
+inline bool parseFaceLine(MeshTextCursor& in, int numVertices, bool alpha, Face& f) {
+    if (!in.nextDataLine()) return in.fail("unexpected end of file in face list");
+    int index[3];
+    for (int k = 0; k < 3; ++k) {
+        if (!in.readInt(index[k], "vertex index")) return false;
+        if (index[k] < 1 || index[k] > numVertices) {
+            return in.fail("vertex index " + std::to_string(index[k]) + " out of range 1.." + std::to_string(numVertices));
+        }
+    }
+    f.v1 = static_cast<uint32_t>(index[0] - 1);
+    f.v2 = static_cast<uint32_t>(index[1] - 1);
+    f.v3 = static_cast<uint32_t>(index[2] - 1);
+    for (int k = 0; k < 3; ++k) {
+        int rgba[4] = { 0, 0, 0, 255 };
+        for (int j = 0; j < (alpha ? 4 : 3); ++j) {
+            if (!in.readInt(rgba[j], alpha ? "12 color values" : "9 color values")) return false;
+        }
+        f.colors[k] = RGBA8::pack(rgba[0], rgba[1], rgba[2], rgba[3]);
+    }
+    in.skipRestOfLine(); // Ignore any stray values after the colors
+    return true;
+}
+
+// Function to parse the text of a mesh file; on failure returns false and sets error
+inline bool parseMeshText(const char* text, size_t length, Mesh& mesh, std::string& error) {
+    MeshTextCursor in(text, text + length);
+    mesh = Mesh();
+
+    int numFaces = 0;
+    bool alpha = false;
+    if (!parseMeshHeader(in, mesh, numFaces, alpha)) {
+        error = in.error;
+        return false;
+    }
+    mesh.faces.resize(static_cast<size_t>(numFaces));
+    for (Face& f : mesh.faces) {
+        if (!parseFaceLine(in, static_cast<int>(mesh.x.size()), alpha, f)) {
+            error = in.error;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to write a mesh in the text format. Lines are formatted with
+// std::to_chars into a large buffer, so meshes of millions of faces are
+// written at disk speed; floats are written in their shortest exact form.
+inline bool writeTextMesh(const std::string& filename, const MeshView& mesh, std::string& error) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        error = "could not create file " + filename;
+        return false;
+    }
+
+    const size_t LINE_BYTES = 256; // More than the longest line written
+    std::vector<char> buffer(size_t(1) << 20);
+    char* out = buffer.data();
+    auto beginLine = [&] {
+        if (static_cast<size_t>(out - buffer.data()) + LINE_BYTES > buffer.size()) {
+            file.write(buffer.data(), out - buffer.data());
+            out = buffer.data();
+        }
+    };
+    auto text = [&](const char* s) {
+        size_t n = std::strlen(s);
+        std::memcpy(out, s, n);
+        out += n;
+    };
+    auto number = [&](auto value, char separator) {
+        out = std::to_chars(out, buffer.data() + buffer.size(), value).ptr;
+        *out++ = separator;
+    };
+
+    beginLine();
+    text("# image size\n");
+    number(mesh.width, ' ');
+    number(mesh.height, '\n');
+    text("\n# vertex list\n");
+    number(mesh.numVertices, mesh.z || mesh.u ? ' ' : '\n');
+    if (mesh.z) text(mesh.u ? "z " : "z\n");
+    if (mesh.u) text("uv\n");
+    for (uint32_t i = 0; i < mesh.numVertices; ++i) {
+        beginLine();
+        number(mesh.x[i], ' ');
+        number(mesh.y[i], mesh.z || mesh.u ? ' ' : '\n');
+        if (mesh.z) number(mesh.z[i], mesh.u ? ' ' : '\n');
+        if (mesh.u) {
+            number(mesh.u[i], ' ');
+            number(mesh.v[i], '\n');
+        }
+    }
+
+    bool alpha = false; // Opacities are only written when some corner is not opaque
+    for (uint32_t i = 0; i < mesh.numFaces && !alpha; ++i) {
+        for (int k = 0; k < 3; ++k) alpha = alpha || (mesh.faces[i].colors[k] >> 24) != 0xFF;
+    }
+    beginLine();
+    text("\n# face list\n");
+    number(mesh.numFaces, alpha ? ' ' : '\n');
+    if (alpha) text("rgba\n");
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+        beginLine();
+        const Face& f = mesh.faces[i];
+        number(f.v1 + 1, ' ');
+        number(f.v2 + 1, ' ');
+        number(f.v3 + 1, ' ');
+        for (int k = 0; k < 3; ++k) {
+            number(f.colors[k] & 0xFF, ' ');
+            number((f.colors[k] >> 8) & 0xFF, ' ');
+            if (alpha) {
+                number((f.colors[k] >> 16) & 0xFF, ' ');
+                number(f.colors[k] >> 24, k < 2 ? ' ' : '\n');
+            } else {
+                number((f.colors[k] >> 16) & 0xFF, k < 2 ? ' ' : '\n');
+            }
+        }
+    }
+    file.write(buffer.data(), out - buffer.data());
+
+    if (!file) {
+        error = "could not write to " + filename;
+        return false;
+    }
+    return true;
+}
+
+// Arrays that can be stored in a binary mesh file, in file order
+enum BinaryMeshArray {
+    MESH_ARRAY_X,     // int32_t x[numVertices]
+    MESH_ARRAY_Y,     // int32_t y[numVertices]
+    MESH_ARRAY_FACES, // Face faces[numFaces]
+    MESH_ARRAY_Z,     // float z[numVertices], optional
+    MESH_ARRAY_U,     // float u[numVertices], optional
+    MESH_ARRAY_V,     // float v[numVertices], optional
+    MESH_ARRAY_SLOTS = 8
+};
+
+// Header of a binary mesh file. All arrays follow the header at 64-byte
+// aligned offsets; numbers are stored little-endian.
+struct BinaryMeshHeader {
+    char magic[4];          // "BMSH"
+    uint32_t version;       // BINARY_MESH_VERSION
+    uint32_t headerSize;    // sizeof(BinaryMeshHeader)
+    uint32_t arrays;        // Bit i is set when array i is present
+    int32_t width, height;  // Image size
+    uint32_t numVertices;
+    uint32_t numFaces;
+    uint64_t fileSize;      // Total size, to detect truncated files
+    uint64_t offsets[MESH_ARRAY_SLOTS]; // Byte offset of each array, 0 when absent
+};
+
+const uint32_t BINARY_MESH_VERSION = 2;
+const uint64_t BINARY_MESH_ALIGNMENT = 64;
+const uint32_t BINARY_MESH_REQUIRED_ARRAYS = (1u << MESH_ARRAY_X) | (1u << MESH_ARRAY_Y) | (1u << MESH_ARRAY_FACES);
+
+// Function to check whether a buffer starts with the binary mesh magic
+inline bool isBinaryMesh(const char* data, size_t length) {
+    return length >= 4 && std::memcmp(data, "BMSH", 4) == 0;
+}
+
+// Function to round an offset up to the array alignment
+inline uint64_t alignOffset(uint64_t offset) {
+    return (offset + BINARY_MESH_ALIGNMENT - 1) & ~(BINARY_MESH_ALIGNMENT - 1);
+}
+
+// Function to get the size in bytes of one array of the file
+inline uint64_t binaryMeshArrayBytes(int array, uint32_t numVertices, uint32_t numFaces) {
+    switch (array) {
+    case MESH_ARRAY_X:
+    case MESH_ARRAY_Y:     return uint64_t(numVertices) * sizeof(int32_t);
+    case MESH_ARRAY_FACES: return uint64_t(numFaces) * sizeof(Face);
+    case MESH_ARRAY_Z:
+    case MESH_ARRAY_U:
+    case MESH_ARRAY_V:     return uint64_t(numVertices) * sizeof(float);
+    default:               return 0;
+    }
+}
+
+// Function to get the data of one array of a mesh, or nullptr when the mesh does not have it
+inline const void* binaryMeshArrayData(const MeshView& mesh, int array) {
+    switch (array) {
+    case MESH_ARRAY_X:     return mesh.x;
+    case MESH_ARRAY_Y:     return mesh.y;
+    case MESH_ARRAY_FACES: return mesh.faces;
+    case MESH_ARRAY_Z:     return mesh.z;
+    case MESH_ARRAY_U:     return mesh.u;
+    case MESH_ARRAY_V:     return mesh.v;
+    default:               return nullptr;
+    }
+}
+
+// Function to place the present arrays one after another; returns the file size
+inline uint64_t layoutBinaryMesh(uint32_t arrays, uint32_t numVertices, uint32_t numFaces, uint64_t* offsets) {
+    uint64_t end = sizeof(BinaryMeshHeader);
+    for (int i = 0; i < MESH_ARRAY_SLOTS; ++i) {
+        offsets[i] = 0;
+        if (arrays & (1u << i)) {
+            offsets[i] = alignOffset(end);
+            end = offsets[i] + binaryMeshArrayBytes(i, numVertices, numFaces);
+        }
+    }
+    return end;
+}
+
+// Function to fill in the header, including array offsets, for a mesh
+inline BinaryMeshHeader makeBinaryMeshHeader(const MeshView& mesh) {
+    BinaryMeshHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "BMSH", 4);
+    header.version = BINARY_MESH_VERSION;
+    header.headerSize = sizeof(BinaryMeshHeader);
+    header.arrays = BINARY_MESH_REQUIRED_ARRAYS;
+    if (mesh.z) header.arrays |= 1u << MESH_ARRAY_Z;
+    if (mesh.u && mesh.v) header.arrays |= (1u << MESH_ARRAY_U) | (1u << MESH_ARRAY_V);
+    header.width = mesh.width;
+    header.height = mesh.height;
+    header.numVertices = mesh.numVertices;
+    header.numFaces = mesh.numFaces;
+    header.fileSize = layoutBinaryMesh(header.arrays, mesh.numVertices, mesh.numFaces, header.offsets);
+    return header;
+}
+
+// Function to write a mesh as a binary mesh file
+inline bool writeBinaryMesh(const std::string& filename, const MeshView& mesh, std::string& error) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        error = "could not create file " + filename;
+        return false;
+    }
+
+    BinaryMeshHeader header = makeBinaryMeshHeader(mesh);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t position = sizeof(header);
+    const char zeros[BINARY_MESH_ALIGNMENT] = {};
+    for (int i = 0; i < MESH_ARRAY_SLOTS; ++i) {
+        if (!(header.arrays & (1u << i))) continue;
+        uint64_t size = binaryMeshArrayBytes(i, mesh.numVertices, mesh.numFaces);
+        file.write(zeros, static_cast<std::streamsize>(header.offsets[i] - position)); // Padding
+        file.write(static_cast<const char*>(binaryMeshArrayData(mesh, i)), static_cast<std::streamsize>(size));
+        position = header.offsets[i] + size;
+    }
+
+    if (!file) {
+        error = "could not write to " + filename;
+        return false;
+    }
+    return true;
+}
+
+// Function to point a mesh view at the arrays of a mapped binary mesh file.
+// Only the header is read, so this is O(1) regardless of mesh size; face
+// indices are bounds-checked by the renderer at triangle setup.
+inline bool viewBinaryMesh(const char* data, size_t length, MeshView& mesh, std::string& error) {
+    if (length < sizeof(BinaryMeshHeader) || !isBinaryMesh(data, length)) {
+        error = "not a binary mesh file";
+        return false;
+    }
+    BinaryMeshHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version != BINARY_MESH_VERSION || header.headerSize != sizeof(BinaryMeshHeader)) {
+        error = "unsupported binary mesh version " + std::to_string(header.version);
+        return false;
+    }
+    if ((header.arrays & BINARY_MESH_REQUIRED_ARRAYS) != BINARY_MESH_REQUIRED_ARRAYS) {
+        error = "binary mesh is missing vertex or face arrays";
+        return false;
+    }
+
+    // The stored offsets must match the layout for these counts, and the file must hold all of it
+    uint64_t offsets[MESH_ARRAY_SLOTS];
+    uint64_t fileSize = layoutBinaryMesh(header.arrays, header.numVertices, header.numFaces, offsets);
+    if (fileSize != header.fileSize || std::memcmp(offsets, header.offsets, sizeof(offsets)) != 0) {
+        error = "corrupt binary mesh header";
+        return false;
+    }
+    if (header.fileSize > length) {
+        error = "truncated binary mesh file";
+        return false;
+    }
+    if (header.width <= 0 || header.height <= 0) {
+        error = "image size must be positive";
+        return false;
+    }
+
+    mesh = MeshView();
+    mesh.width = header.width;
+    mesh.height = header.height;
+    mesh.numVertices = header.numVertices;
+    mesh.numFaces = header.numFaces;
+    mesh.x = reinterpret_cast<const int32_t*>(data + offsets[MESH_ARRAY_X]);
+    mesh.y = reinterpret_cast<const int32_t*>(data + offsets[MESH_ARRAY_Y]);
+    mesh.faces = reinterpret_cast<const Face*>(data + offsets[MESH_ARRAY_FACES]);
+    if (offsets[MESH_ARRAY_Z]) mesh.z = reinterpret_cast<const float*>(data + offsets[MESH_ARRAY_Z]);
+    if (offsets[MESH_ARRAY_U] && offsets[MESH_ARRAY_V]) {
+        mesh.u = reinterpret_cast<const float*>(data + offsets[MESH_ARRAY_U]);
+        mesh.v = reinterpret_cast<const float*>(data + offsets[MESH_ARRAY_V]);
+    }
+    return true;
+}
+
+// A mesh ready for rendering: text files are parsed into owned arrays,
+// binary files are used in place from the memory mapping
+struct LoadedMesh {
+    Mesh owned;
+    MappedFile file;
+    MeshView view;
+};
+
+// Function to load a text or binary mesh file; on failure returns false and sets error
+inline bool loadMesh(const std::string& filename, LoadedMesh& mesh, std::string& error) {
+    if (!mesh.file.open(filename)) {
+        error = "could not open file " + filename;
+        return false;
+    }
+    if (isBinaryMesh(mesh.file.data(), mesh.file.size())) {
+        if (!viewBinaryMesh(mesh.file.data(), mesh.file.size(), mesh.view, error)) {
+            error = filename + ": " + error;
+            return false;
+        }
+        return true;
+    }
+
+    bool parsed = parseMeshText(mesh.file.data(), mesh.file.size(), mesh.owned, error);
+    mesh.file.close(); // The text is no longer needed once parsed
+    if (!parsed) {
+        error = filename + ": " + error;
+        return false;
+    }
+    mesh.view = mesh.owned.view();
+    return true;
+}
+
+// A mesh whose faces are read in order, a batch at a time, instead of all at
+// once. Only the vertices are held in memory (text files) or mapped (binary
+// files); the text of the face list is read through the mapping, whose pages
+// the system can drop again once they have been parsed.
+struct MeshFaceStream {
+    Mesh owned;           // Vertices of a text mesh (faces stay empty)
+    MappedFile file;
+    MeshView view;        // Vertices, face count and, for binary meshes, the mapped faces
+    MeshTextCursor cursor; // Position in the face list of a text mesh
+    bool alpha = false;    // Whether the face lines of a text mesh carry opacities
+    uint32_t nextFace = 0;
+
+    // Function to open a mesh file and load everything but the faces
+    bool open(const std::string& filename, std::string& error) {
+        if (!file.open(filename)) {
+            error = "could not open file " + filename;
+            return false;
+        }
+        nextFace = 0;
+        if (isBinaryMesh(file.data(), file.size())) {
+            if (!viewBinaryMesh(file.data(), file.size(), view, error)) {
+                error = filename + ": " + error;
+                return false;
+            }
+            return true;
+        }
+
+        owned = Mesh();
+        cursor = MeshTextCursor(file.data(), file.data() + file.size());
+        int numFaces = 0;
+        if (!parseMeshHeader(cursor, owned, numFaces, alpha)) {
+            error = filename + ": " + cursor.error;
+            return false;
+        }
+        view = owned.view();
+        view.numFaces = static_cast<uint32_t>(numFaces);
+        view.faces = nullptr; // Faces are only available through read()
+        return true;
+    }
+
+    // Function to read up to maxFaces of the next faces; count is 0 once all were read
+    bool read(Face* faces, uint32_t maxFaces, uint32_t& count, std::string& error) {
+        count = std::min(maxFaces, view.numFaces - nextFace);
+        if (view.faces) {
+            std::memcpy(faces, view.faces + nextFace, count * sizeof(Face));
+        } else {
+            for (uint32_t i = 0; i < count; ++i) {
+                if (!parseFaceLine(cursor, static_cast<int>(view.numVertices), alpha, faces[i])) {
+                    error = cursor.error;
+                    return false;
+                }
+            }
+        }
+        nextFace += count;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,274 @@
+// Mesh optimizations for the vertex stage: merging duplicate vertices, ordering
+// the faces so a post-transform vertex cache keyed by vertex index hits often,
+// and ordering the vertices as the faces first use them.
+//
+// The transform stage (transform.h) already transforms every vertex once, in
+// bulk, so its work is per unique vertex of the vertex list. Deduplication
+// makes that list hold each distinct vertex once. Face order matters to work
+// done per face corner, such as the vertex fetches of triangle setup: it is
+// measured by replaying the corners through a model of a FIFO post-transform
+// cache, the way GPUs reuse transformed vertices, and improved with Tom
+// Forsyth's linear-speed vertex cache optimisation, which greedily emits the
+// face whose vertices score best for their place in a modelled LRU cache and
+// how few faces still need them.
+//
+// Merging vertices and renumbering them keeps every face's vertex values, so
+// the mesh renders exactly as before. Reordering faces changes draw order:
+// faces that overlap in painter's order, or at equal depth, may then draw
+// differently.
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <unordered_map>
+#include <type_traits>
+#include <algorithm>
+
+#include "mesh_io.h"
+
+const int VERTEX_CACHE_SIZE = 32;          // Entries of the modelled LRU cache scored by optimizeVertexCache
+const uint32_t NO_VERTEX = 0xFFFFFFFFu;    // Index of a vertex not (or no longer) in a list
+
+// Result of replaying the face corners of a mesh through a FIFO vertex cache
+struct VertexCacheStats {
+    uint64_t transforms = 0; // Cache misses: vertices transformed
+    double acmr = 0;         // Average cache miss ratio, transforms per face (0.5 at best, 3 at worst)
+    double atvr = 0;         // Average transform to vertex ratio, transforms per referenced vertex (1 at best)
+};
+
+// Function to copy a mesh view, e.g. one mapped from a binary file, into owned arrays
+inline void copyMesh(const MeshView& view, Mesh& mesh) {
+    mesh.width = view.width;
+    mesh.height = view.height;
+    mesh.x.assign(view.x, view.x + view.numVertices);
+    mesh.y.assign(view.y, view.y + view.numVertices);
+    mesh.z.assign(view.z, view.z ? view.z + view.numVertices : view.z);
+    mesh.u.assign(view.u, view.u ? view.u + view.numVertices : view.u);
+    mesh.v.assign(view.v, view.v ? view.v + view.numVertices : view.v);
+    mesh.faces.assign(view.faces, view.faces + view.numFaces);
+}
+
+inline bool validFace(const Face& face, size_t numVertices) {
+    return face.v1 < numVertices && face.v2 < numVertices && face.v3 < numVertices;
+}
+
+// Function to replay the face corners in order through a FIFO cache of cacheSize vertices
+inline VertexCacheStats analyzeVertexCache(const MeshView& mesh, int cacheSize = VERTEX_CACHE_SIZE) {
+    VertexCacheStats stats;
+    const uint64_t size = static_cast<uint64_t>(std::max(cacheSize, 1));
+    std::vector<uint64_t> insertedAt(mesh.numVertices, 0); // Miss that last brought each vertex in, from 1
+    std::vector<bool> referenced(mesh.numVertices, false);
+    uint64_t referencedVertices = 0;
+    for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+        const Face& face = mesh.faces[i];
+        if (!validFace(face, mesh.numVertices)) continue;
+        for (uint32_t v : { face.v1, face.v2, face.v3 }) {
+            // A vertex is still cached while fewer than cacheSize others entered after it
+            if (insertedAt[v] != 0 && stats.transforms - insertedAt[v] < size) continue;
+            insertedAt[v] = ++stats.transforms;
+            if (!referenced[v]) {
+                referenced[v] = true;
+                referencedVertices++;
+            }
+        }
+    }
+    stats.acmr = mesh.numFaces > 0 ? static_cast<double>(stats.transforms) / mesh.numFaces : 0;
+    stats.atvr = referencedVertices > 0 ? static_cast<double>(stats.transforms) / referencedVertices : 0;
+    return stats;
+}
+
+// Function to renumber the vertices by the faces' vertex indices after merging
+// or reordering; remap[old] is the new index, NO_VERTEX for vertices dropped.
+// Faces with an index out of range keep it out of range.
+inline void remapVertices(Mesh& mesh, const std::vector<uint32_t>& remap, uint32_t newCount) {
+    auto move = [&](auto& values) {
+        if (values.empty()) return;
+        typename std::remove_reference<decltype(values)>::type moved(newCount);
+        for (size_t i = 0; i < remap.size(); ++i) {
+            if (remap[i] != NO_VERTEX) moved[remap[i]] = values[i];
+        }
+        values.swap(moved);
+    };
+    move(mesh.x);
+    move(mesh.y);
+    move(mesh.z);
+    move(mesh.u);
+    move(mesh.v);
+    for (Face& face : mesh.faces) {
+        for (uint32_t* index : { &face.v1, &face.v2, &face.v3 }) {
+            *index = *index < remap.size() && remap[*index] != NO_VERTEX ? remap[*index] : NO_VERTEX;
+        }
+    }
+}
+
+// Function to merge vertices with identical coordinates, depth and texture
+// coordinates into one, keeping the first of them; returns how many were merged
+inline uint32_t deduplicateVertices(Mesh& mesh) {
+    struct Key {
+        uint32_t bits[5];
+        bool operator==(const Key& o) const { return std::memcmp(bits, o.bits, sizeof(bits)) == 0; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = 0x9E3779B97F4A7C15ull;
+            for (uint32_t b : key.bits) h = (h ^ b) * 0xBF58476D1CE4E5B9ull;
+            return static_cast<size_t>(h ^ (h >> 31));
+        }
+    };
+
+    const size_t count = mesh.x.size();
+    std::unordered_map<Key, uint32_t, KeyHash> first;
+    first.reserve(count);
+    std::vector<uint32_t> remap(count);
+    uint32_t unique = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Key key = {};
+        std::memcpy(&key.bits[0], &mesh.x[i], 4);
+        std::memcpy(&key.bits[1], &mesh.y[i], 4);
+        if (!mesh.z.empty()) std::memcpy(&key.bits[2], &mesh.z[i], 4);
+        if (!mesh.u.empty()) std::memcpy(&key.bits[3], &mesh.u[i], 4);
+        if (!mesh.v.empty()) std::memcpy(&key.bits[4], &mesh.v[i], 4);
+        auto inserted = first.emplace(key, unique);
+        remap[i] = inserted.first->second;
+        if (inserted.second) unique++;
+    }
+    // Each first occurrence moves to its new index, no later than its old one
+    remapVertices(mesh, remap, unique);
+    return static_cast<uint32_t>(count - unique);
+}
+
+// Function to number the vertices in the order the faces first use them, so
+// consecutive faces read nearby vertex data; unused vertices are dropped.
+// Returns how many were dropped.
+inline uint32_t optimizeVertexFetch(Mesh& mesh) {
+    const size_t count = mesh.x.size();
+    std::vector<uint32_t> remap(count, NO_VERTEX);
+    uint32_t next = 0;
+    for (const Face& face : mesh.faces) {
+        if (!validFace(face, count)) continue;
+        for (uint32_t v : { face.v1, face.v2, face.v3 }) {
+            if (remap[v] == NO_VERTEX) remap[v] = next++;
+        }
+    }
+    remapVertices(mesh, remap, next);
+    return static_cast<uint32_t>(count - next);
+}
+
+// Function to score a vertex for Forsyth's optimisation from its place in the
+// modelled LRU cache (-1 when not cached) and the faces still to use it
+inline float forsythVertexScore(int cachePosition, uint32_t remainingFaces) {
+    if (remainingFaces == 0) return -1; // No face left to emit needs it
+    float score = 0;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f; // Used by the last face: a fixed score, so strips are not favoured over fans
+        } else {
+            float scale = 1 - static_cast<float>(cachePosition - 3) / (VERTEX_CACHE_SIZE - 3);
+            score = std::pow(scale, 1.5f);
+        }
+    }
+    // Boost vertices few faces still need, so they are finished off and leave the cache
+    return score + 2.0f / std::sqrt(static_cast<float>(remainingFaces));
+}
+
+// Function to reorder the faces for the post-transform vertex cache (Forsyth).
+// Faces with an index out of range are moved to the end, in their order.
+inline void optimizeVertexCache(Mesh& mesh) {
+    const size_t numVertices = mesh.x.size();
+    const uint32_t numFaces = static_cast<uint32_t>(mesh.faces.size());
+    auto corners = [&](uint32_t f) {
+        const Face& face = mesh.faces[f];
+        return std::array<uint32_t, 3>{ { face.v1, face.v2, face.v3 } };
+    };
+
+    // Faces of each vertex (a counting sort); the faces still to emit are kept at the front of each list
+    std::vector<uint32_t> faceStart(numVertices + 1, 0), remaining(numVertices, 0);
+    for (uint32_t f = 0; f < numFaces; ++f) {
+        if (!validFace(mesh.faces[f], numVertices)) continue;
+        for (uint32_t v : corners(f)) remaining[v]++;
+    }
+    for (size_t v = 0; v < numVertices; ++v) faceStart[v + 1] = faceStart[v] + remaining[v];
+    std::vector<uint32_t> vertexFaces(faceStart[numVertices]);
+    std::vector<uint32_t> next(faceStart.begin(), faceStart.end() - 1);
+    for (uint32_t f = 0; f < numFaces; ++f) {
+        if (!validFace(mesh.faces[f], numVertices)) continue;
+        for (uint32_t v : corners(f)) vertexFaces[next[v]++] = f;
+    }
+
+    std::vector<int> cachePosition(numVertices, -1);
+    std::vector<float> vertexScore(numVertices), faceScore(numFaces, -1);
+    for (size_t v = 0; v < numVertices; ++v) vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    std::vector<bool> emitted(numFaces, false);
+    uint32_t best = NO_VERTEX;
+    for (uint32_t f = 0; f < numFaces; ++f) {
+        if (!validFace(mesh.faces[f], numVertices)) continue;
+        faceScore[f] = 0;
+        for (uint32_t v : corners(f)) faceScore[f] += vertexScore[v];
+        if (best == NO_VERTEX || faceScore[f] > faceScore[best]) best = f;
+    }
+
+    std::vector<Face> ordered;
+    ordered.reserve(numFaces);
+    std::vector<uint32_t> cache, grown;
+    uint32_t scan = 0; // Faces before this one have all been emitted or are invalid
+    while (true) {
+        if (best == NO_VERTEX) {
+            // No cached vertex has a face left: continue with the next face in mesh order
+            while (scan < numFaces && (emitted[scan] || !validFace(mesh.faces[scan], numVertices))) scan++;
+            if (scan == numFaces) break;
+            best = scan;
+        }
+        uint32_t f = best;
+        emitted[f] = true;
+        ordered.push_back(mesh.faces[f]);
+
+        // Take the face off the lists of its vertices
+        for (uint32_t v : corners(f)) {
+            uint32_t* first = vertexFaces.data() + faceStart[v];
+            uint32_t* last = first + remaining[v];
+            std::iter_swap(std::find(first, last, f), last - 1);
+            remaining[v]--;
+        }
+
+        // Its vertices move to the front of the cache; the cache grows by up to three
+        // for now, so the vertices pushed out are rescored too
+        grown.clear();
+        for (uint32_t v : corners(f)) {
+            if (std::find(grown.begin(), grown.end(), v) == grown.end()) grown.push_back(v);
+        }
+        const size_t fresh = grown.size();
+        for (uint32_t v : cache) {
+            if (std::find(grown.begin(), grown.begin() + fresh, v) == grown.begin() + fresh) grown.push_back(v);
+        }
+        for (size_t i = 0; i < grown.size(); ++i) {
+            uint32_t v = grown[i];
+            cachePosition[v] = i < VERTEX_CACHE_SIZE ? static_cast<int>(i) : -1;
+            vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+        }
+
+        // Rescore the faces left on the cached vertices; the best of them is emitted next
+        best = NO_VERTEX;
+        for (uint32_t v : grown) {
+            for (uint32_t i = faceStart[v]; i < faceStart[v] + remaining[v]; ++i) {
+                uint32_t g = vertexFaces[i];
+                float score = 0;
+                for (uint32_t w : corners(g)) score += vertexScore[w];
+                faceScore[g] = score;
+                if (best == NO_VERTEX || score > faceScore[best]) best = g;
+            }
+        }
+        grown.resize(std::min<size_t>(grown.size(), VERTEX_CACHE_SIZE));
+        cache.swap(grown);
+    }
+
+    for (uint32_t f = 0; f < numFaces; ++f) {
+        if (!validFace(mesh.faces[f], numVertices)) ordered.push_back(mesh.faces[f]);
+    }
+    mesh.faces.swap(ordered);
+}
+
+#endif // MESH_OPTIMIZE_H
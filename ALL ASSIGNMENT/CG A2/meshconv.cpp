@@ -0,0 +1,108 @@
+// Converts a mesh from the text format read by barycen (e.g. tower.txt), or an
+// OBJ model, to the binary .bmesh container, which barycen maps and renders
+// without parsing. Output names that do not end in .bmesh get the text format,
+// as with meshgen, so .bmesh files can be converted back. It can also optimize
+// the mesh for the vertex stage on the way (see mesh_optimize.h).
+//
+// Usage: meshconv [--dedup | --optimize] <input.txt | input.bmesh | input.obj> [output.bmesh | output.txt] [OBJ image size]
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "mesh_io.h"
+#include "obj_io.h"
+#include "mesh_optimize.h"
+
+using namespace std;
+
+void printUsage() {
+    cerr << "Usage: meshconv [--dedup | --optimize] <input.txt | input.bmesh | input.obj> [output.bmesh | output.txt] [OBJ image size]\n"
+         << "  the output is a binary .bmesh unless its name has another extension, which writes the text format\n"
+         << "  --dedup     merge duplicate vertices and number them in the order the faces use them;\n"
+         << "              the mesh renders exactly as before\n"
+         << "  --optimize  also reorder the faces for a post-transform vertex cache, which changes\n"
+         << "              draw order where faces overlap at equal or no depth" << endl;
+}
+
+// Function to print how the face order of a mesh uses a vertex cache
+void printCacheStats(const char* label, const MeshView& mesh) {
+    VertexCacheStats stats = analyzeVertexCache(mesh);
+    cout << label << mesh.numVertices << " vertices, " << stats.transforms << " transforms with a "
+         << VERTEX_CACHE_SIZE << "-entry FIFO cache (" << stats.acmr << " per face, " << stats.atvr
+         << " per vertex)" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool dedup = false, optimize = false;
+    vector<string> positional;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--dedup") {
+            dedup = true;
+        } else if (arg == "--optimize") {
+            dedup = optimize = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            cerr << "Error: unknown option '" << arg << "'" << endl;
+            printUsage();
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.empty() || positional.size() > 3) {
+        printUsage();
+        return 1;
+    }
+    string inputFile = positional[0];
+    string outputFile = positional.size() > 1 ? positional[1] : inputFile.substr(0, inputFile.find_last_of('.')) + ".bmesh";
+
+    if (outputFile == inputFile) {
+        cerr << "Error: the output would overwrite the input " << inputFile << endl;
+        return 1;
+    }
+    bool binary = outputFile.size() >= 6 && outputFile.compare(outputFile.size() - 6, 6, ".bmesh") == 0;
+
+    int objImageSize = positional.size() > 2 ? atoi(positional[2].c_str()) : OBJ_DEFAULT_IMAGE_SIZE;
+
+    // Read the text or OBJ mesh
+    LoadedMesh mesh;
+    string error;
+    bool loaded = isObjFile(inputFile) ? loadObjMesh(inputFile, objImageSize, mesh, error) : loadMesh(inputFile, mesh, error);
+    if (!loaded) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+
+    MeshView view = mesh.view;
+    Mesh optimized;
+    if (dedup) {
+        printCacheStats("Before: ", view);
+        copyMesh(view, optimized);
+        uint32_t merged = deduplicateVertices(optimized);
+        bool reordered = false;
+        if (optimize) {
+            // Keep the input order when it already suits the cache better, as generated meshes may
+            uint64_t inputTransforms = analyzeVertexCache(optimized.view()).transforms;
+            vector<Face> inputOrder = optimized.faces;
+            optimizeVertexCache(optimized);
+            reordered = analyzeVertexCache(optimized.view()).transforms < inputTransforms;
+            if (!reordered) optimized.faces.swap(inputOrder);
+        }
+        uint32_t unused = optimizeVertexFetch(optimized);
+        view = optimized.view();
+        cout << "Merged " << merged << " duplicate vertices and dropped " << unused << " unused ones"
+             << (reordered ? "; reordered the faces" : optimize ? "; kept the face order, which suits the cache better" : "")
+             << endl;
+        printCacheStats("After:  ", view);
+    }
+
+    // Write it out in the binary layout, or as text
+    if (!(binary ? writeBinaryMesh(outputFile, view, error) : writeTextMesh(outputFile, view, error))) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    cout << "Converted " << view.numVertices << " vertices and " << view.numFaces
+         << " faces to " << outputFile << endl;
+    return 0;
+}
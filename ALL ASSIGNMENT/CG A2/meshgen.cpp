@@ -0,0 +1,126 @@
+// Generates procedural benchmark meshes (see mesh_gen.h) in the text format
+// read by barycen, or in the binary .bmesh container when the output name
+// ends in .bmesh.
+//
+// Usage: meshgen <geosphere | grid | soup | slivers> [options] [-o output]
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+
+#include "mesh_io.h"
+#include "mesh_gen.h"
+
+using namespace std;
+
+void printUsage() {
+    cerr << "Usage: meshgen <geosphere | grid | soup | slivers> [options]\n"
+         << "  -o <file>          output mesh, text or .bmesh (default: <shape>.txt)\n"
+         << "  --faces <n>        number of faces, e.g. 1e6 (default 1000); geospheres have 20 f^2 faces\n"
+         << "                     and grids two per cell, whichever is closest to n\n"
+         << "  --size <w> <h>     image size (default 1024 1024)\n"
+         << "  --seed <n>         seed of the random positions, sizes, depths and colors (default 1)\n"
+         << "  --tri-size <a> <b> size range of soup triangles and length range of slivers in pixels (default 4 64)\n"
+         << "  --dist <d>         distribution of sizes in that range: log (default) or uniform\n"
+         << "  --sliver-width <w> distance of a sliver's apex from its long side in pixels (default 1)\n"
+         << "  --z                give grids, soups and slivers depth (geospheres always have it)\n"
+         << "  --uv               give vertices texture coordinates\n"
+         << "  --opacity <a>      opacity of every vertex from 0 to 255 (default 255); barycen blends faces below 255" << endl;
+}
+
+// Function to read a count that may be written in scientific notation (1e7)
+bool parseCount(const char* text, uint64_t& value) {
+    char* end = nullptr;
+    double number = strtod(text, &end);
+    if (end == text || *end != '\0' || !(number >= 0) || number > 1e18) return false;
+    value = static_cast<uint64_t>(number + 0.5);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    MeshGenOptions options;
+    string shape = argv[1];
+    if (shape == "geosphere") {
+        options.shape = SHAPE_GEOSPHERE;
+    } else if (shape == "grid") {
+        options.shape = SHAPE_GRID;
+    } else if (shape == "soup") {
+        options.shape = SHAPE_SOUP;
+    } else if (shape == "slivers") {
+        options.shape = SHAPE_SLIVERS;
+    } else {
+        cerr << "Error: unknown shape '" << shape << "'" << endl;
+        printUsage();
+        return 1;
+    }
+
+    string outputFile = shape + ".txt";
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg == "--faces" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.faces)) {
+                cerr << "Error: invalid face count '" << argv[i] << "'" << endl;
+                return 1;
+            }
+        } else if (arg == "--size" && i + 2 < argc) {
+            options.width = atoi(argv[++i]);
+            options.height = atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--tri-size" && i + 2 < argc) {
+            options.minSize = atof(argv[++i]);
+            options.maxSize = atof(argv[++i]);
+        } else if (arg == "--dist" && i + 1 < argc) {
+            string distribution = argv[++i];
+            if (distribution == "log") {
+                options.distribution = SIZE_LOG_UNIFORM;
+            } else if (distribution == "uniform") {
+                options.distribution = SIZE_UNIFORM;
+            } else {
+                cerr << "Error: unknown size distribution '" << distribution << "'" << endl;
+                return 1;
+            }
+        } else if (arg == "--sliver-width" && i + 1 < argc) {
+            options.sliverWidth = atof(argv[++i]);
+        } else if (arg == "--z") {
+            options.depth = true;
+        } else if (arg == "--uv") {
+            options.texcoords = true;
+        } else if (arg == "--opacity" && i + 1 < argc) {
+            options.opacity = atoi(argv[++i]);
+        } else {
+            cerr << "Error: unknown or incomplete option '" << arg << "'" << endl;
+            printUsage();
+            return 1;
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    Mesh mesh;
+    string error;
+    if (!generateMesh(options, mesh, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    auto generated = chrono::steady_clock::now();
+
+    bool binary = outputFile.size() >= 6 && outputFile.compare(outputFile.size() - 6, 6, ".bmesh") == 0;
+    MeshView view = mesh.view();
+    if (!(binary ? writeBinaryMesh(outputFile, view, error) : writeTextMesh(outputFile, view, error))) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    auto written = chrono::steady_clock::now();
+
+    cout << "Generated " << view.numVertices << " vertices and " << view.numFaces << " faces to " << outputFile
+         << " (" << chrono::duration<double, milli>(generated - start).count() << " ms generating, "
+         << chrono::duration<double, milli>(written - generated).count() << " ms writing)" << endl;
+    return 0;
+}
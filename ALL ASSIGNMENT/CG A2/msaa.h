@@ -0,0 +1,198 @@
+// Multisample buffer for anti-aliasing: every pixel has 4 or 8 color samples at
+// fixed positions inside it. Triangles are shaded once per pixel and the color
+// is stored in the samples they cover; the final image is the average of each
+// pixel's samples.
+//
+// A pixel whose samples all hold the same color is uniform and is just the
+// pixel of the image, so pixels fully inside a triangle are written exactly as
+// without anti-aliasing. Only pixels on triangle edges are expanded into
+// separate samples. Their samples live in a pool that grows by one slot per
+// pixel ever expanded, so memory, the clear and the resolve all scale with the
+// expanded pixels rather than with the image.
+//
+// Depth works the same way when it is tested: a uniform pixel keeps a single
+// depth, at its center, in the ordinary depth buffer, together with the depth
+// slopes of the surface drawn there, from which the depth of any of its samples
+// follows. A fragment whose depth range overlaps the stored one, as where two
+// surfaces intersect, is tested sample by sample, and the pixel is expanded
+// when only some samples pass. Expanded pixels keep a depth per sample and
+// store the farthest of them in the depth buffer, so its hierarchical tiles
+// stay valid.
+#ifndef MSAA_H
+#define MSAA_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "framebuffer.h"
+#include "depth_buffer.h"
+
+const int MSAA_MAX_SAMPLES = 8;
+const int MSAA_SUBPIXEL = 16; // Sample offsets are in 1/16 pixel
+
+// Sample offsets from the pixel center in 1/16 pixel (the standard rotated patterns)
+struct SamplePattern {
+    int count;
+    int offset[MSAA_MAX_SAMPLES][2];
+};
+
+inline const SamplePattern& samplePattern(int samples) {
+    static const SamplePattern pattern4 = { 4, { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } } };
+    static const SamplePattern pattern8 = { 8, { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 },
+                                                 { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } } };
+    return samples == 8 ? pattern8 : pattern4;
+}
+
+// Convert a pixel of any format to the RGBA8 color of a sample
+template <typename Format>
+uint32_t sampleColor(const typename Format::Pixel& p) {
+    int rgb[3];
+    Format::unpack(p, rgb);
+    return RGBA8::pack(rgb[0], rgb[1], rgb[2]);
+}
+
+// Function to compute how far the depth of each sample lies from the depth at the
+// pixel center, on a surface whose depth changes by dzdx and dzdy per pixel
+inline void sampleDepthOffsets(const SamplePattern& pattern, float dzdx, float dzdy, float* offsets) {
+    for (int s = 0; s < pattern.count; ++s) {
+        offsets[s] = (dzdx * pattern.offset[s][0] + dzdy * pattern.offset[s][1]) / MSAA_SUBPIXEL;
+    }
+}
+
+struct MultisampleBuffer {
+    int width = 0, height = 0;
+    int samples = 0;
+    uint32_t fullMask = 0;              // Coverage mask with every sample set
+    const SamplePattern* pattern = nullptr;
+    bool depthTested = false;
+    std::vector<uint8_t> expanded;      // 1 for pixels with separate samples
+    std::vector<uint32_t> slot;         // Pool slot of each pixel plus one, 0 for pixels without one
+    std::vector<size_t> slotPixels;     // Pixel of each slot, in the order the slots were handed out
+    std::vector<uint32_t> sampleColors; // RGBA8 samples, all samples of a slot together
+    std::vector<float> sampleDepths;    // Depth samples of each slot; empty unless depth tested
+    std::vector<float> depthSlopes;     // Depth change per pixel in x and y of each uniform pixel; depth tested only
+    std::vector<float> tileSpread;      // Per depth tile, how far a sample of a uniform pixel may lie from its center depth
+    float maxSpread = 0;                // The largest tile spread
+
+    void resize(int w, int h, int sampleCount, bool withDepth) {
+        size_t pixels = static_cast<size_t>(w) * h;
+        if (pixels != expanded.size() || sampleCount != samples) {
+            // Only a new size needs fresh per-pixel state; clear() resets the pixels used since
+            expanded.assign(pixels, 0);
+            slot.assign(pixels, 0);
+            slotPixels.clear();
+        }
+        width = w;
+        height = h;
+        samples = sampleCount;
+        fullMask = (1u << samples) - 1;
+        pattern = &samplePattern(samples);
+        depthTested = withDepth;
+        if (withDepth && depthSlopes.size() != 2 * pixels) depthSlopes.assign(2 * pixels, 0.0f);
+        size_t tiles = static_cast<size_t>((w + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT) * ((h + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT);
+        tileSpread.resize(withDepth ? tiles : 0);
+    }
+
+    // Make every pixel uniform, as the image is cleared; only the pixels that were
+    // given a slot can be anything else
+    void clear() {
+        for (size_t pixel : slotPixels) {
+            expanded[pixel] = 0;
+            slot[pixel] = 0;
+        }
+        slotPixels.clear();
+        sampleColors.clear();
+        sampleDepths.clear();
+        std::fill(tileSpread.begin(), tileSpread.end(), 0.0f);
+        maxSpread = 0;
+    }
+
+    size_t pixelIndex(int x, int y) const { return static_cast<size_t>(y) * width + x; }
+
+    // Function to return the pool slot of a pixel, handing out the next one if it has none
+    size_t acquire(size_t pixel) {
+        if (slot[pixel] == 0) addSlot(pixel);
+        return slot[pixel] - 1;
+    }
+
+    // Function to grow the pools by a slot for a pixel (kept apart so acquire inlines)
+    void addSlot(size_t pixel) {
+        slotPixels.push_back(pixel);
+        slot[pixel] = static_cast<uint32_t>(slotPixels.size());
+        sampleColors.resize(slotPixels.size() * samples);
+        if (depthTested) sampleDepths.resize(slotPixels.size() * samples);
+    }
+
+    uint32_t* colorSamples(size_t slotIndex) { return &sampleColors[slotIndex * samples]; }
+    float* depthSamples(size_t slotIndex) { return &sampleDepths[slotIndex * samples]; }
+
+    // Mark the pixels [x0, x1] of row y uniform after the image was written there
+    void setUniform(int y, int x0, int x1) {
+        std::memset(&expanded[pixelIndex(x0, y)], 0, static_cast<size_t>(x1 - x0 + 1));
+    }
+
+    // Record the depth slopes of the surface written to uniform pixel (x, y)
+    void setSlopes(int x, int y, float dzdx, float dzdy) {
+        float* slope = &depthSlopes[2 * pixelIndex(x, y)];
+        slope[0] = dzdx;
+        slope[1] = dzdy;
+    }
+
+    // Function to compute the depths of the samples of uniform pixel (x, y) from
+    // its center depth z and the slopes of its surface
+    void uniformSampleDepths(int x, int y, float z, float* depths) const {
+        const float* slope = &depthSlopes[2 * pixelIndex(x, y)];
+        sampleDepthOffsets(*pattern, slope[0], slope[1], depths);
+        for (int s = 0; s < samples; ++s) depths[s] += z;
+    }
+
+    // Function to widen the spread of a depth tile, by its index in the depth
+    // buffer, after uniform pixels of a surface with that spread were written there
+    void widenTileSpread(int tile, float spread) {
+        tileSpread[tile] = std::max(tileSpread[tile], spread);
+        maxSpread = std::max(maxSpread, spread);
+    }
+
+    // Function to store color c in the samples of image pixel (x, y) selected by mask
+    template <typename Format>
+    void write(Framebuffer<Format>& image, int x, int y, uint32_t mask, const typename Format::Pixel& c) {
+        size_t pixel = pixelIndex(x, y);
+        if (mask == fullMask) {
+            image.row(y)[x] = c;
+            expanded[pixel] = 0;
+            return;
+        }
+        uint32_t* sample = colorSamples(acquire(pixel));
+        if (!expanded[pixel]) { // Expand to separate samples before writing some of them
+            std::fill(sample, sample + samples, sampleColor<Format>(image.row(y)[x]));
+            expanded[pixel] = 1;
+        }
+        uint32_t color = sampleColor<Format>(c);
+        for (int s = 0; s < samples; ++s) {
+            sample[s] = (mask >> s) & 1 ? color : sample[s];
+        }
+    }
+
+    // Function to average the samples of every expanded pixel into the image; only
+    // pixels that were given a slot are visited
+    template <typename Format>
+    void resolve(Framebuffer<Format>& image) const {
+        for (size_t i = 0; i < slotPixels.size(); ++i) {
+            size_t pixel = slotPixels[i];
+            if (!expanded[pixel]) continue;
+            const uint32_t* sample = &sampleColors[i * samples];
+            int sum[3] = { 0, 0, 0 };
+            for (int s = 0; s < samples; ++s) {
+                sum[0] += sample[s] & 0xFF;
+                sum[1] += (sample[s] >> 8) & 0xFF;
+                sum[2] += (sample[s] >> 16) & 0xFF;
+            }
+            int half = samples / 2;
+            image.pixels[pixel] = Format::pack((sum[0] + half) / samples, (sum[1] + half) / samples, (sum[2] + half) / samples);
+        }
+    }
+};
+
+#endif
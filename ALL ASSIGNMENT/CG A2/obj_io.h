@@ -0,0 +1,467 @@
+// Loading of Wavefront OBJ meshes: v (optionally followed by an r g b color),
+// vt, vn and f statements; everything else (o, g, s, usemtl, mtllib, l, ...) is
+// ignored. Polygons are split into triangle fans and negative indices count
+// back from the latest element, as in the OBJ specification.
+//
+// The memory-mapped text is cut into chunks of whole lines, one per thread. A
+// first pass counts the v, vt and vn lines of every chunk, so the second pass
+// stores each element straight into its final place and resolves every index,
+// negative ones included, to a global one. Face corners are then deduplicated
+// into an indexed vertex buffer with one vertex per distinct position and
+// texture coordinate pair.
+//
+// The renderer draws in pixels of an image, so the model, authored with y up
+// and seen along -z, is scaled to fit an image whose longer side has the
+// requested size: x to the right, y down and depth growing away from the
+// viewer, the model space of the transform stage. Each corner is colored by
+// its vertex color when any v line has one (white for vertices without),
+// otherwise by its normal (vn, or the face normal) mapped to RGB.
+#ifndef OBJ_IO_H
+#define OBJ_IO_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <charconv>
+#include <algorithm>
+
+#include "mesh_io.h"
+
+const int OBJ_DEFAULT_IMAGE_SIZE = 1024;
+const size_t OBJ_MIN_CHUNK_BYTES = 1 << 20; // Smaller files use fewer threads
+
+// Function to check whether a file name has the .obj extension (any case)
+inline bool isObjFile(const std::string& filename) {
+    if (filename.size() < 4) return false;
+    std::string extension = filename.substr(filename.size() - 4);
+    for (char& c : extension) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return extension == ".obj";
+}
+
+// Triangle corner as global 0-based indices; vt and vn are -1 when not given
+struct ObjCorner {
+    int32_t v, vt, vn;
+};
+
+// Chunk of whole lines of an OBJ file and what was found in it
+struct ObjChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    int firstLine = 0;               // Lines before the chunk
+    int lines = 0;
+    uint32_t counts[3] = { 0, 0, 0 }; // v, vt and vn lines in the chunk
+    uint32_t first[3] = { 0, 0, 0 };  // v, vt and vn lines before the chunk
+    bool colored = false;            // Some v line of the chunk has a color
+    std::vector<ObjCorner> corners;  // Three per triangle
+    std::string error;
+};
+
+// Elements of an OBJ file, filled by the chunks in parallel
+struct ObjElements {
+    uint32_t totals[3] = { 0, 0, 0 }; // v, vt and vn in the file
+    std::vector<float> positions;     // x y z
+    std::vector<float> colors;        // r g b (0-1); empty unless the file has vertex colors
+    std::vector<float> texcoords;     // u v
+    std::vector<float> normals;       // x y z
+};
+
+// Function to run body(i) for i in [0, count) on count threads (inline for one)
+template <typename Body>
+void runObjThreads(size_t count, Body body) {
+    if (count == 1) {
+        body(0);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < count; ++i) threads.emplace_back(body, i);
+    for (std::thread& t : threads) t.join();
+}
+
+// Function to tell what a line starting at p defines: 0 for v, 1 for vt, 2 for vn,
+// 3 for f and -1 for anything else
+inline int objStatement(const char* p, const char* end) {
+    auto separator = [&](const char* q) { return q >= end || MeshTextCursor::isSeparator(*q); };
+    if (p >= end) return -1;
+    if (*p == 'f') return separator(p + 1) ? 3 : -1;
+    if (*p != 'v' || p + 1 >= end) return -1;
+    if (separator(p + 1)) return 0;
+    if (p[1] == 't' && separator(p + 2)) return 1;
+    if (p[1] == 'n' && separator(p + 2)) return 2;
+    return -1;
+}
+
+// Function to check whether a value follows on the current line
+inline bool objMoreOnLine(MeshTextCursor& in) {
+    while (in.p < in.end && (*in.p == ' ' || *in.p == '\t')) ++in.p;
+    return in.p < in.end && *in.p != '\n' && *in.p != '\r' && *in.p != '#';
+}
+
+// Function to count the whitespace-separated values on a line, up to a comment
+inline int countObjValues(const char* p, const char* end) {
+    int values = 0;
+    bool inValue = false;
+    for (; p < end && *p != '#' && *p != '\n' && *p != '\r'; ++p) {
+        bool space = *p == ' ' || *p == '\t';
+        values += !space && !inValue;
+        inValue = !space;
+    }
+    return values;
+}
+
+// Function to count the lines and the v, vt and vn statements of a chunk
+inline void countObjChunk(ObjChunk& chunk) {
+    for (const char* p = chunk.begin; p < chunk.end;) {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(chunk.end - p)));
+        const char* next = newline ? newline + 1 : chunk.end;
+        chunk.lines++;
+        while (p < next && (*p == ' ' || *p == '\t')) ++p;
+        int statement = objStatement(p, next);
+        if (statement >= 0 && statement < 3) chunk.counts[statement]++;
+        if (statement == 0 && !chunk.colored) {
+            // The file has vertex colors when any v line has x y z r g b
+            chunk.colored = countObjValues(p + 1, next) >= 6;
+        }
+        p = next;
+    }
+}
+
+// Function to parse one index of a face corner; index is the 1-based (or negative)
+// value as written, resolved to a 0-based one below count
+inline bool parseObjIndex(MeshTextCursor& in, uint32_t count, uint32_t total, const char* what, int32_t& index) {
+    long long value = 0;
+    std::from_chars_result result = std::from_chars(in.p, in.end, value);
+    if (result.ec != std::errc()) return in.fail(std::string("expected ") + what + " index");
+    in.p = result.ptr;
+    long long resolved = value > 0 ? value - 1 : static_cast<long long>(count) + value;
+    if (value == 0 || resolved < 0 || resolved >= total) {
+        return in.fail(std::string(what) + " index " + std::to_string(value) + " out of range");
+    }
+    index = static_cast<int32_t>(resolved);
+    return true;
+}
+
+// Function to parse the statements of a chunk, storing its elements into place
+// and its triangles into chunk.corners; on failure sets in.error
+inline bool parseObjStatements(MeshTextCursor& in, ObjChunk& chunk, ObjElements& elements) {
+    uint32_t count[3] = { chunk.first[0], chunk.first[1], chunk.first[2] }; // Elements defined so far
+    std::vector<ObjCorner> polygon;
+    while (in.nextDataLine()) {
+        int statement = objStatement(in.p, in.end);
+        if (statement == 0) {
+            in.p += 1;
+            float* position = &elements.positions[3 * size_t(count[0])];
+            for (int k = 0; k < 3; ++k) {
+                if (!in.readFloat(position[k], "vertex coordinate")) return false;
+            }
+            if (!elements.colors.empty() && objMoreOnLine(in)) {
+                float values[4];
+                int n = 0;
+                while (n < 4 && objMoreOnLine(in) && in.readFloat(values[n], "vertex color")) ++n;
+                if (!in.error.empty()) return false; // A value that is not a number
+                if (n == 3) std::copy(values, values + 3, &elements.colors[3 * size_t(count[0])]);
+            }
+            count[0]++;
+        } else if (statement == 1) {
+            in.p += 2;
+            float* texcoord = &elements.texcoords[2 * size_t(count[1])];
+            if (!in.readFloat(texcoord[0], "texture coordinate")) return false;
+            texcoord[1] = 0;
+            if (objMoreOnLine(in) && !in.readFloat(texcoord[1], "texture coordinate")) return false;
+            count[1]++;
+        } else if (statement == 2) {
+            in.p += 2;
+            float* normal = &elements.normals[3 * size_t(count[2])];
+            for (int k = 0; k < 3; ++k) {
+                if (!in.readFloat(normal[k], "normal coordinate")) return false;
+            }
+            count[2]++;
+        } else if (statement == 3) {
+            // Corners are v, v/vt, v//vn or v/vt/vn
+            in.p += 1;
+            polygon.clear();
+            while (objMoreOnLine(in)) {
+                ObjCorner corner = { -1, -1, -1 };
+                if (!parseObjIndex(in, count[0], elements.totals[0], "vertex", corner.v)) return false;
+                if (in.p < in.end && *in.p == '/') {
+                    ++in.p;
+                    if (in.p < in.end && *in.p != '/' &&
+                        !parseObjIndex(in, count[1], elements.totals[1], "texture coordinate", corner.vt)) {
+                        return false;
+                    }
+                    if (in.p < in.end && *in.p == '/') {
+                        ++in.p;
+                        if (!parseObjIndex(in, count[2], elements.totals[2], "normal", corner.vn)) return false;
+                    }
+                }
+                if (in.p < in.end && !MeshTextCursor::isSeparator(*in.p)) return in.fail("malformed face corner");
+                polygon.push_back(corner);
+            }
+            if (polygon.size() < 3) return in.fail("face with fewer than 3 vertices");
+            for (size_t k = 1; k + 1 < polygon.size(); ++k) { // Triangle fan around the first corner
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[k]);
+                chunk.corners.push_back(polygon[k + 1]);
+            }
+        }
+        in.skipRestOfLine();
+    }
+    return true;
+}
+
+// Function to parse one chunk; on failure sets chunk.error
+inline bool parseObjChunk(ObjChunk& chunk, ObjElements& elements) {
+    MeshTextCursor in(chunk.begin, chunk.end);
+    in.line = chunk.firstLine;
+    if (parseObjStatements(in, chunk, elements)) return true;
+    chunk.error = in.error;
+    return false;
+}
+
+// Open-addressing map from (position, texture coordinate) pairs to vertex indices;
+// it doubles whenever it would become more than half full
+struct ObjVertexMap {
+    std::vector<uint64_t> keys; // ~0 marks an empty slot
+    std::vector<uint32_t> values;
+    uint64_t mask = 0;
+    size_t size = 0; // Keys stored
+
+    explicit ObjVertexMap(size_t entries) {
+        size_t capacity = 16;
+        while (capacity < 2 * entries) capacity *= 2;
+        keys.assign(capacity, ~uint64_t(0));
+        values.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    uint64_t home(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ull) >> 20 & mask; }
+
+    // Function to move every key into a table of twice the capacity
+    void grow() {
+        std::vector<uint64_t> oldKeys(2 * keys.size(), ~uint64_t(0));
+        std::vector<uint32_t> oldValues(oldKeys.size());
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        mask = keys.size() - 1;
+        for (size_t i = 0; i < oldKeys.size(); ++i) {
+            if (oldKeys[i] == ~uint64_t(0)) continue;
+            uint64_t slot = home(oldKeys[i]);
+            while (keys[slot] != ~uint64_t(0)) slot = (slot + 1) & mask;
+            keys[slot] = oldKeys[i];
+            values[slot] = oldValues[i];
+        }
+    }
+
+    // Function to return the index of key, inserting it as next when it is new
+    uint32_t find(uint64_t key, uint32_t& next) {
+        for (uint64_t slot = home(key);; slot = (slot + 1) & mask) {
+            if (keys[slot] == key) return values[slot];
+            if (keys[slot] == ~uint64_t(0)) {
+                if (2 * (size + 1) > keys.size()) { // Keep an empty slot to end every probe
+                    grow();
+                    slot = home(key);
+                    while (keys[slot] != ~uint64_t(0)) slot = (slot + 1) & mask;
+                }
+                keys[slot] = key;
+                values[slot] = next;
+                size++;
+                return next++;
+            }
+        }
+    }
+};
+
+// Function to convert a normal or a color in [0, 1] to a channel value
+inline int objChannel(float value) {
+    return std::min(255, std::max(0, static_cast<int>(value * 255 + 0.5f)));
+}
+
+// Function to color a corner from its vertex color, its normal or the face normal
+inline uint32_t objCornerColor(const ObjElements& elements, const ObjCorner& corner, const float* faceNormal) {
+    if (!elements.colors.empty()) {
+        const float* c = &elements.colors[3 * size_t(corner.v)];
+        return RGBA8::pack(objChannel(c[0]), objChannel(c[1]), objChannel(c[2]));
+    }
+    const float* n = corner.vn >= 0 ? &elements.normals[3 * size_t(corner.vn)] : faceNormal;
+    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    float scale = length > 0 ? 0.5f / length : 0.0f;
+    return RGBA8::pack(objChannel(n[0] * scale + 0.5f), objChannel(n[1] * scale + 0.5f), objChannel(n[2] * scale + 0.5f));
+}
+
+// Function to parse the text of an OBJ file into a mesh fitted to an image whose
+// longer side is imageSize pixels, on up to maxThreads threads; on failure
+// returns false and sets error
+inline bool parseObjText(const char* text, size_t length, int imageSize, int maxThreads, Mesh& mesh, std::string& error) {
+    mesh = Mesh();
+
+    // Cut the text into chunks of whole lines and count what each defines
+    size_t threads = std::max<size_t>(1, std::min<size_t>(static_cast<size_t>(std::max(1, maxThreads)),
+                                                          length / OBJ_MIN_CHUNK_BYTES));
+    std::vector<ObjChunk> chunks(threads);
+    const char* end = text + length;
+    const char* p = text;
+    for (size_t i = 0; i < threads; ++i) {
+        chunks[i].begin = p;
+        const char* cut = i + 1 == threads ? end : std::max(p, text + length / threads * (i + 1));
+        if (cut < end) {
+            const char* newline = static_cast<const char*>(std::memchr(cut, '\n', static_cast<size_t>(end - cut)));
+            cut = newline ? newline + 1 : end;
+        }
+        chunks[i].end = p = cut;
+    }
+    runObjThreads(threads, [&](size_t i) { countObjChunk(chunks[i]); });
+
+    ObjElements elements;
+    bool colored = false;
+    for (ObjChunk& chunk : chunks) {
+        if (&chunk != &chunks[0]) chunk.firstLine = (&chunk - 1)->firstLine + (&chunk - 1)->lines;
+        for (int k = 0; k < 3; ++k) {
+            chunk.first[k] = elements.totals[k];
+            elements.totals[k] += chunk.counts[k];
+        }
+        colored = colored || chunk.colored;
+    }
+    elements.positions.resize(3 * size_t(elements.totals[0]));
+    if (colored) elements.colors.assign(3 * size_t(elements.totals[0]), 1.0f);
+    elements.texcoords.resize(2 * size_t(elements.totals[1]));
+    elements.normals.resize(3 * size_t(elements.totals[2]));
+
+    // Parse every chunk into place
+    runObjThreads(threads, [&](size_t i) { parseObjChunk(chunks[i], elements); });
+    size_t numCorners = 0;
+    for (const ObjChunk& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            error = chunk.error;
+            return false;
+        }
+        numCorners += chunk.corners.size();
+    }
+
+    // Vertex buffer: the positions themselves unless corners carry texture
+    // coordinates, else one vertex per distinct pair in order of first use
+    bool textured = false;
+    for (const ObjChunk& chunk : chunks) {
+        for (const ObjCorner& corner : chunk.corners) {
+            if (corner.vt >= 0) {
+                textured = true;
+                break;
+            }
+        }
+        if (textured) break;
+    }
+    std::vector<uint32_t> cornerVertex; // Vertex of every corner when textured
+    std::vector<uint32_t> vertexPosition, vertexTexcoord;
+    if (textured) {
+        cornerVertex.resize(numCorners);
+        // Sized for the usual few texture coordinates per position; the map grows past that
+        ObjVertexMap map(std::min<size_t>(numCorners, size_t(elements.totals[0]) * 4 + 16));
+        uint32_t next = 0;
+        size_t c = 0;
+        for (const ObjChunk& chunk : chunks) {
+            for (const ObjCorner& corner : chunk.corners) {
+                uint64_t key = uint64_t(uint32_t(corner.v)) << 32 | uint32_t(corner.vt);
+                uint32_t vertex = map.find(key, next);
+                if (vertex == vertexPosition.size()) {
+                    vertexPosition.push_back(static_cast<uint32_t>(corner.v));
+                    vertexTexcoord.push_back(static_cast<uint32_t>(corner.vt));
+                }
+                cornerVertex[c++] = vertex;
+            }
+        }
+    }
+    size_t numVertices = textured ? vertexPosition.size() : elements.totals[0];
+    if (numVertices > UINT32_MAX / 2 || numCorners / 3 > UINT32_MAX / 2) {
+        error = "too many vertices or faces";
+        return false;
+    }
+
+    // Fit the model into the image, y up becoming y down and z toward the viewer becoming near
+    float lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+    for (uint32_t i = 0; i < elements.totals[0]; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            float value = elements.positions[3 * size_t(i) + k];
+            lo[k] = i == 0 ? value : std::min(lo[k], value);
+            hi[k] = i == 0 ? value : std::max(hi[k], value);
+        }
+    }
+    float extentX = hi[0] - lo[0], extentY = hi[1] - lo[1], longer = std::max(extentX, extentY);
+    imageSize = std::max(1, imageSize);
+    mesh.width = longer > 0 && extentX < extentY ? std::max(1, static_cast<int>(imageSize * extentX / longer + 0.5f)) : imageSize;
+    mesh.height = longer > 0 && extentY < extentX ? std::max(1, static_cast<int>(imageSize * extentY / longer + 0.5f)) : imageSize;
+    float scale = longer > 0 ? 0.9f * imageSize / longer : 1.0f; // 5% margin on every side
+    float centerX = (lo[0] + hi[0]) / 2, centerY = (lo[1] + hi[1]) / 2;
+
+    mesh.x.resize(numVertices);
+    mesh.y.resize(numVertices);
+    mesh.z.resize(numVertices);
+    if (textured) {
+        mesh.u.assign(numVertices, 0.0f);
+        mesh.v.assign(numVertices, 0.0f);
+    }
+    for (size_t i = 0; i < numVertices; ++i) {
+        const float* position = &elements.positions[3 * size_t(textured ? vertexPosition[i] : i)];
+        mesh.x[i] = static_cast<int32_t>(std::lround((position[0] - centerX) * scale + mesh.width / 2.0f));
+        mesh.y[i] = static_cast<int32_t>(std::lround((centerY - position[1]) * scale + mesh.height / 2.0f));
+        mesh.z[i] = (hi[2] - position[2]) * scale;
+        if (textured && vertexTexcoord[i] != UINT32_MAX) { // Corners without one keep (0, 0)
+            const float* texcoord = &elements.texcoords[2 * size_t(vertexTexcoord[i])];
+            mesh.u[i] = texcoord[0];
+            mesh.v[i] = 1 - texcoord[1]; // OBJ v runs up the texture
+        }
+    }
+
+    // Faces, each chunk's triangles converted on its own thread
+    mesh.faces.resize(numCorners / 3);
+    std::vector<size_t> firstCorner(threads, 0);
+    for (size_t i = 1; i < threads; ++i) firstCorner[i] = firstCorner[i - 1] + chunks[i - 1].corners.size();
+    runObjThreads(threads, [&](size_t i) {
+        const std::vector<ObjCorner>& corners = chunks[i].corners;
+        for (size_t c = 0; c < corners.size(); c += 3) {
+            size_t global = firstCorner[i] + c;
+            Face& face = mesh.faces[global / 3];
+            uint32_t vertex[3];
+            for (int k = 0; k < 3; ++k) {
+                vertex[k] = textured ? cornerVertex[global + k] : static_cast<uint32_t>(corners[c + k].v);
+            }
+            face.v1 = vertex[0];
+            face.v2 = vertex[1];
+            face.v3 = vertex[2];
+
+            float faceNormal[3] = { 0, 0, 0 };
+            if (elements.colors.empty() && (corners[c].vn < 0 || corners[c + 1].vn < 0 || corners[c + 2].vn < 0)) {
+                const float* a = &elements.positions[3 * size_t(corners[c].v)];
+                const float* b = &elements.positions[3 * size_t(corners[c + 1].v)];
+                const float* d = &elements.positions[3 * size_t(corners[c + 2].v)];
+                float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+                faceNormal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+                faceNormal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+                faceNormal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            }
+            for (int k = 0; k < 3; ++k) face.colors[k] = objCornerColor(elements, corners[c + k], faceNormal);
+        }
+    });
+    return true;
+}
+
+// Function to load an OBJ file into a mesh fitted to an image whose longer side is
+// imageSize pixels; on failure returns false and sets error
+inline bool loadObjMesh(const std::string& filename, int imageSize, LoadedMesh& mesh, std::string& error) {
+    if (!mesh.file.open(filename)) {
+        error = "could not open file " + filename;
+        return false;
+    }
+    int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    bool parsed = parseObjText(mesh.file.data(), mesh.file.size(), imageSize, threads, mesh.owned, error);
+    mesh.file.close(); // The text is no longer needed once parsed
+    if (!parsed) {
+        error = filename + ": " + error;
+        return false;
+    }
+    mesh.view = mesh.owned.view();
+    return true;
+}
+
+#endif
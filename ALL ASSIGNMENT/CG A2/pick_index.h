@@ -0,0 +1,293 @@
+// Spatial index answering which face is drawn at a pixel, and where in that face,
+// for many query points without visiting every face per query.
+//
+// The faces are binned into a uniform grid of square cells over the image,
+// stored compactly like the row bands of barycen: the faces of cell c are
+// faces[cellStart[c]] to faces[cellStart[c + 1] - 1], in mesh order. A face is
+// listed in the cells of its bounding box that are not wholly outside one of
+// its edges. The cell side is a power of two near half that of the average
+// face bounding box, so a face lands in a few cells and a query tests few more
+// faces than overlap its pixel.
+//
+// A query picks the face the rasterizer draws at the pixel: inside means every
+// edge function is >= 0, exact for integer vertices, so a pixel on a shared
+// edge belongs to both faces. Among the faces covering it, meshes with depth
+// keep the nearest (the first of equal float depth), other meshes the last
+// face in painter's order.
+#ifndef PICK_INDEX_H
+#define PICK_INDEX_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include "mesh_io.h"
+
+const uint32_t PICK_NO_FACE = 0xFFFFFFFFu; // Face of a point no face covers
+const int PICK_MAX_CELL_SHIFT = 12;        // Cells are at most 4096 pixels wide
+const int PICK_BATCH_SIZE = 1024;          // Points queried per task by pickPoints
+
+// Vertex coordinates within this many pixels of the image have exact 64-bit
+// edge functions; larger triangles are tested in double precision
+const long long PICK_EXACT_RANGE = 1 << 20;
+
+// A query point, in pixels
+struct PickPoint {
+    int x, y;
+};
+
+// Face under a query point and the barycentric weights of its three vertices
+struct PickHit {
+    uint32_t face = PICK_NO_FACE;
+    double weights[3] = { 0, 0, 0 };
+};
+
+// Which winding, as seen on screen with y pointing down, is left out of the index
+enum PickCull {
+    PICK_CULL_NONE,
+    PICK_CULL_CW,  // Skip clockwise faces (positive signed area), as barycen --cull cw
+    PICK_CULL_CCW  // Skip counter-clockwise faces (negative signed area)
+};
+
+class PickIndex {
+public:
+    // Function to index the faces of a mesh; the mesh must outlive the index
+    void build(const MeshView& meshView, PickCull cull = PICK_CULL_NONE) {
+        mesh = meshView;
+        cellStart.clear();
+        faces.clear();
+        cellShift = 0;
+        cellsX = cellsY = 0;
+        if (mesh.width <= 0 || mesh.height <= 0) return;
+
+        // Keep the faces the rasterizer would draw, with their bounding boxes clipped to the image
+        std::vector<Box> boxes(mesh.numFaces);
+        std::vector<uint32_t> kept;
+        double boxArea = 0;
+        for (uint32_t i = 0; i < mesh.numFaces; ++i) {
+            if (!clippedBox(mesh.faces[i], cull, boxes[i])) continue;
+            kept.push_back(i);
+            boxArea += static_cast<double>(boxes[i].maxX - boxes[i].minX + 1) * (boxes[i].maxY - boxes[i].minY + 1);
+        }
+
+        // Cells about half the size of an average face, but not many more of them than faces
+        double side = kept.empty() ? mesh.width : std::sqrt(boxArea / kept.size()) / 2;
+        while (cellShift < PICK_MAX_CELL_SHIFT && (1 << (cellShift + 1)) <= side) cellShift++;
+        const double maxCells = 4.0 * kept.size() + 64;
+        while (cellShift < PICK_MAX_CELL_SHIFT && cellCount(cellShift) > maxCells) cellShift++;
+        cellsX = ((mesh.width - 1) >> cellShift) + 1;
+        cellsY = ((mesh.height - 1) >> cellShift) + 1;
+
+        // Count the faces of each cell, then place them (a counting sort, so no list is resized)
+        cellStart.assign(static_cast<size_t>(cellsX) * cellsY + 1, 0);
+        for (uint32_t i : kept) {
+            forEachCell(mesh.faces[i], boxes[i], [&](size_t cell) { cellStart[cell + 1]++; });
+        }
+        for (size_t c = 0; c + 1 < cellStart.size(); ++c) cellStart[c + 1] += cellStart[c];
+        faces.resize(cellStart.back());
+        std::vector<uint32_t> next(cellStart.begin(), cellStart.end() - 1);
+        for (uint32_t i : kept) {
+            forEachCell(mesh.faces[i], boxes[i], [&](size_t cell) { faces[next[cell]++] = i; });
+        }
+    }
+
+    // Function to find the face drawn at pixel (x, y)
+    PickHit query(int x, int y) const {
+        PickHit hit;
+        if (x < 0 || y < 0 || x >= mesh.width || y >= mesh.height || cellStart.empty()) return hit;
+        size_t cell = static_cast<size_t>(y >> cellShift) * cellsX + (x >> cellShift);
+        const uint32_t* first = faces.data() + cellStart[cell];
+        const uint32_t* last = faces.data() + cellStart[cell + 1];
+        double weights[3];
+        if (!mesh.z) {
+            // Painter's order: the last face covering the pixel is the one drawn
+            for (const uint32_t* f = last; f != first; --f) {
+                if (covers(f[-1], x, y, weights)) {
+                    setHit(hit, f[-1], weights);
+                    break;
+                }
+            }
+            return hit;
+        }
+        float nearest = std::numeric_limits<float>::infinity();
+        for (const uint32_t* f = first; f != last; ++f) {
+            if (!covers(*f, x, y, weights)) continue;
+            const Face& face = mesh.faces[*f];
+            float z = static_cast<float>(weights[0] * mesh.z[face.v1] + weights[1] * mesh.z[face.v2] + weights[2] * mesh.z[face.v3]);
+            if (z < nearest) { // Strict, so the first face of equal depth stays
+                nearest = z;
+                setHit(hit, *f, weights);
+            }
+        }
+        return hit;
+    }
+
+    // Number of grid cells and face references, and the cell side in pixels
+    size_t cells() const { return cellStart.empty() ? 0 : cellStart.size() - 1; }
+    size_t references() const { return faces.size(); }
+    int cellSize() const { return 1 << cellShift; }
+
+private:
+    struct Box {
+        int minX, minY, maxX, maxY;
+    };
+
+    MeshView mesh;
+    int cellShift = 0;
+    int cellsX = 0, cellsY = 0;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> faces;
+
+    double cellCount(int shift) const {
+        return static_cast<double>(((mesh.width - 1) >> shift) + 1) * (((mesh.height - 1) >> shift) + 1);
+    }
+
+    // Function to compute the image-clipped bounding box of a face; returns false
+    // for faces the rasterizer never draws (invalid, degenerate, culled or off-screen)
+    bool clippedBox(const Face& face, PickCull cull, Box& box) const {
+        if (face.v1 >= mesh.numVertices || face.v2 >= mesh.numVertices || face.v3 >= mesh.numVertices) return false;
+        if (mesh.w && !(std::min(mesh.w[face.v1], std::min(mesh.w[face.v2], mesh.w[face.v3])) >= mesh.nearZ)) return false;
+        double area = signedArea(face);
+        if (area == 0) return false;
+        if ((cull == PICK_CULL_CW && area > 0) || (cull == PICK_CULL_CCW && area < 0)) return false;
+        const int32_t* x = mesh.x;
+        const int32_t* y = mesh.y;
+        box.minX = std::max(0, std::min(x[face.v1], std::min(x[face.v2], x[face.v3])));
+        box.maxX = std::min(mesh.width - 1, std::max(x[face.v1], std::max(x[face.v2], x[face.v3])));
+        box.minY = std::max(0, std::min(y[face.v1], std::min(y[face.v2], y[face.v3])));
+        box.maxY = std::min(mesh.height - 1, std::max(y[face.v1], std::max(y[face.v2], y[face.v3])));
+        return box.minX <= box.maxX && box.minY <= box.maxY;
+    }
+
+    // Twice the signed area of a face, only exact when its vertices are near the image
+    double signedArea(const Face& face) const {
+        double ax = mesh.x[face.v1], ay = mesh.y[face.v1];
+        return (mesh.x[face.v2] - ax) * (mesh.y[face.v3] - ay) - (mesh.y[face.v2] - ay) * (mesh.x[face.v3] - ax);
+    }
+
+    // Function to call visit(cell) for each cell a face may cover: the cells of its
+    // bounding box, less those wholly outside one of its edges (so long, thin faces
+    // are not listed all along their bounding box)
+    template <typename Visit>
+    void forEachCell(const Face& face, const Box& box, Visit visit) const {
+        const uint32_t v[3] = { face.v1, face.v2, face.v3 };
+        bool skipOutside = nearImage(v[0]) && nearImage(v[1]) && nearImage(v[2]);
+        double edges[3][3]; // A, B, C of each edge, oriented so that the inside is >= 0; exact near the image
+        double sign = signedArea(face) > 0 ? 1 : -1;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t p = v[(k + 1) % 3], q = v[(k + 2) % 3];
+            double A = sign * (static_cast<double>(mesh.y[p]) - mesh.y[q]);
+            double B = sign * (static_cast<double>(mesh.x[q]) - mesh.x[p]);
+            edges[k][0] = A;
+            edges[k][1] = B;
+            edges[k][2] = -(A * mesh.x[p] + B * mesh.y[p]);
+        }
+        for (int cy = box.minY >> cellShift; cy <= box.maxY >> cellShift; ++cy) {
+            int y0 = std::max(box.minY, cy << cellShift), y1 = std::min(box.maxY, ((cy + 1) << cellShift) - 1);
+            for (int cx = box.minX >> cellShift; cx <= box.maxX >> cellShift; ++cx) {
+                int x0 = std::max(box.minX, cx << cellShift), x1 = std::min(box.maxX, ((cx + 1) << cellShift) - 1);
+                bool outside = false;
+                for (int k = 0; k < 3 && skipOutside && !outside; ++k) {
+                    // The edge function is largest at one corner of the cell
+                    const double* e = edges[k];
+                    outside = e[0] * (e[0] > 0 ? x1 : x0) + e[1] * (e[1] > 0 ? y1 : y0) + e[2] < 0;
+                }
+                if (!outside) visit(static_cast<size_t>(cy) * cellsX + cx);
+            }
+        }
+    }
+
+    bool nearImage(uint32_t v) const {
+        return mesh.x[v] >= -PICK_EXACT_RANGE && mesh.x[v] < mesh.width + PICK_EXACT_RANGE &&
+               mesh.y[v] >= -PICK_EXACT_RANGE && mesh.y[v] < mesh.height + PICK_EXACT_RANGE;
+    }
+
+    // Function to test whether a face covers pixel (x, y) and compute the weights of its vertices there
+    bool covers(uint32_t index, int x, int y, double* weights) const {
+        const Face& face = mesh.faces[index];
+        const uint32_t v[3] = { face.v1, face.v2, face.v3 };
+        if (nearImage(v[0]) && nearImage(v[1]) && nearImage(v[2])) {
+            // Edge function of the edge opposite each vertex, exact in 64 bits
+            long long e[3];
+            for (int k = 0; k < 3; ++k) {
+                uint32_t p = v[(k + 1) % 3], q = v[(k + 2) % 3];
+                e[k] = (static_cast<long long>(mesh.x[q]) - mesh.x[p]) * (static_cast<long long>(y) - mesh.y[p])
+                     - (static_cast<long long>(mesh.y[q]) - mesh.y[p]) * (static_cast<long long>(x) - mesh.x[p]);
+            }
+            long long area = e[0] + e[1] + e[2];
+            if (area > 0 ? (e[0] < 0 || e[1] < 0 || e[2] < 0) : (e[0] > 0 || e[1] > 0 || e[2] > 0)) return false;
+            for (int k = 0; k < 3; ++k) weights[k] = static_cast<double>(e[k]) / area;
+            return true;
+        }
+        double e[3];
+        for (int k = 0; k < 3; ++k) {
+            uint32_t p = v[(k + 1) % 3], q = v[(k + 2) % 3];
+            e[k] = (static_cast<double>(mesh.x[q]) - mesh.x[p]) * (static_cast<double>(y) - mesh.y[p])
+                 - (static_cast<double>(mesh.y[q]) - mesh.y[p]) * (static_cast<double>(x) - mesh.x[p]);
+        }
+        double area = e[0] + e[1] + e[2];
+        if (area == 0) return false;
+        if (area > 0 ? (e[0] < 0 || e[1] < 0 || e[2] < 0) : (e[0] > 0 || e[1] > 0 || e[2] > 0)) return false;
+        for (int k = 0; k < 3; ++k) weights[k] = e[k] / area;
+        return true;
+    }
+
+    static void setHit(PickHit& hit, uint32_t face, const double* weights) {
+        hit.face = face;
+        std::copy(weights, weights + 3, hit.weights);
+    }
+};
+
+// Function to answer a batch of queries, shared out to threads in fixed-size chunks
+inline void pickPoints(const PickIndex& index, const PickPoint* points, size_t count, PickHit* hits, int threads) {
+    const size_t batches = (count + PICK_BATCH_SIZE - 1) / PICK_BATCH_SIZE;
+    std::atomic<size_t> nextBatch(0);
+    auto worker = [&] {
+        for (size_t batch = nextBatch++; batch < batches; batch = nextBatch++) {
+            size_t end = std::min(count, (batch + 1) * PICK_BATCH_SIZE);
+            for (size_t i = batch * PICK_BATCH_SIZE; i < end; ++i) hits[i] = index.query(points[i].x, points[i].y);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads && static_cast<size_t>(t) < batches; ++t) workers.emplace_back(worker);
+    worker();
+    for (std::thread& t : workers) t.join();
+}
+
+// Function to read query points, one "x y" pair of integer pixel coordinates per
+// line; blank lines and lines starting with # are skipped
+inline bool readPickPoints(const std::string& filename, std::vector<PickPoint>& points, std::string& error) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        error = "Could not open file " + filename;
+        return false;
+    }
+    points.clear();
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') continue;
+        const char* text = line.c_str() + start;
+        char* end = nullptr;
+        long x = std::strtol(text, &end, 10);
+        bool valid = end != text;
+        text = end;
+        long y = std::strtol(text, &end, 10);
+        valid = valid && end != text && line.find_first_not_of(" \t\r", end - line.c_str()) == std::string::npos;
+        if (!valid || x < INT32_MIN || x > INT32_MAX || y < INT32_MIN || y > INT32_MAX) {
+            error = filename + ":" + std::to_string(number) + ": expected two integer pixel coordinates";
+            return false;
+        }
+        points.push_back(PickPoint{ static_cast<int>(x), static_cast<int>(y) });
+    }
+    return true;
+}
+
+#endif // PICK_INDEX_H
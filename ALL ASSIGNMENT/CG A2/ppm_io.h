@@ -0,0 +1,302 @@
+// Reading and writing of PPM images for the framebuffer.
+// Both P6 and P3 files with a maximum value up to 255 can be read.
+// Binary P6 is written with one bulk write of the pixel data; ASCII P3 is
+// formatted a whole row at a time from a lookup table of channel strings.
+// Render targets other than color are written as 16-bit PGM (P5) and PAM (P7).
+#ifndef PPM_IO_H
+#define PPM_IO_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <limits>
+#include <algorithm>
+
+#include "framebuffer.h"
+
+// Output encodings supported by writePPMFile
+enum PPMEncoding {
+    PPM_BINARY, // P6
+    PPM_ASCII   // P3
+};
+
+// Text of every channel value 0-255 followed by a space, e.g. "128 "
+struct ChannelTextTable {
+    char text[256][4];
+    uint8_t length[256];
+
+    ChannelTextTable() {
+        for (int v = 0; v < 256; ++v) {
+            int n = 0;
+            if (v >= 100) text[v][n++] = static_cast<char>('0' + v / 100);
+            if (v >= 10) text[v][n++] = static_cast<char>('0' + (v / 10) % 10);
+            text[v][n++] = static_cast<char>('0' + v % 10);
+            text[v][n++] = ' ';
+            length[v] = static_cast<uint8_t>(n);
+        }
+    }
+};
+
+inline const ChannelTextTable& channelTextTable() {
+    static const ChannelTextTable table;
+    return table;
+}
+
+// Function to convert one row of the framebuffer to packed RGB bytes
+template <typename Format>
+void packRowRGB(const typename Format::Pixel* row, int width, uint8_t* out) {
+    for (int x = 0; x < width; ++x, out += 3) {
+        int rgb[3];
+        Format::unpack(row[x], rgb);
+        out[0] = static_cast<uint8_t>(rgb[0]);
+        out[1] = static_cast<uint8_t>(rgb[1]);
+        out[2] = static_cast<uint8_t>(rgb[2]);
+    }
+}
+
+// Function to format one row as P3 text ("r g b r g b ... \n"); returns the byte count
+template <typename Format>
+size_t formatRowP3(const typename Format::Pixel* row, int width, char* out) {
+    const ChannelTextTable& table = channelTextTable();
+    char* p = out;
+    for (int x = 0; x < width; ++x) {
+        int rgb[3];
+        Format::unpack(row[x], rgb);
+        for (int c = 0; c < 3; ++c) {
+            std::memcpy(p, table.text[rgb[c]], 4); // Copy all 4 bytes, advance by the real length
+            p += table.length[rgb[c]];
+        }
+    }
+    *p++ = '\n';
+    return static_cast<size_t>(p - out);
+}
+
+// Function to write the pixel data of rows [y0, y1) to an open stream
+template <typename Format>
+bool writePPMRows(std::ostream& file, const Framebuffer<Format>& image, int y0, int y1, PPMEncoding encoding) {
+    int width = image.width;
+    if (encoding == PPM_BINARY) {
+        if (Format::rawRGB) {
+            // Storage already matches the P6 layout: one write for all rows
+            file.write(reinterpret_cast<const char*>(image.row(y0)),
+                       static_cast<std::streamsize>(width) * (y1 - y0) * 3);
+        } else {
+            std::vector<uint8_t> bytes(static_cast<size_t>(width) * (y1 - y0) * 3);
+            for (int y = y0; y < y1; ++y) {
+                packRowRGB<Format>(image.row(y), width, bytes.data() + static_cast<size_t>(y - y0) * width * 3);
+            }
+            file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        }
+    } else {
+        std::vector<char> text(static_cast<size_t>(width) * 12 + 2); // Worst case "255 " per channel
+        for (int y = y0; y < y1; ++y) {
+            size_t length = formatRowP3<Format>(image.row(y), width, text.data());
+            file.write(text.data(), static_cast<std::streamsize>(length));
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+// Function to write the PPM header for an image of the given size
+inline void writePPMHeader(std::ostream& file, int width, int height, PPMEncoding encoding) {
+    file << (encoding == PPM_BINARY ? "P6" : "P3") << "\n" << width << " " << height << "\n255\n";
+}
+
+// Function to write the image to a .ppm file
+template <typename Format>
+bool writePPMFile(const std::string& filename, const Framebuffer<Format>& image, PPMEncoding encoding = PPM_BINARY) {
+    std::ofstream file(filename, std::ios::binary); // Open the output file
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file " << filename << std::endl;
+        return false;
+    }
+
+    writePPMHeader(file, image.width, image.height, encoding);
+    if (!writePPMRows(file, image, 0, image.height, encoding)) {
+        std::cerr << "Error: Could not write pixel data to " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Color of a count on a heat scale from black (0) through blue, green and yellow to red (maxCount)
+inline RGB8::Pixel heatmapColor(uint32_t count, uint32_t maxCount) {
+    if (count == 0 || maxCount == 0) return RGB8::pack(0, 0, 0);
+    static const int ramp[5][3] = { { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 } };
+    float t = maxCount > 1 ? 4.0f * (count - 1) / (maxCount - 1) : 4.0f; // Position on the ramp, 0-4
+    int i = std::min(static_cast<int>(t), 3);
+    float f = t - i;
+    return RGB8::pack(static_cast<int>(ramp[i][0] + (ramp[i + 1][0] - ramp[i][0]) * f + 0.5f),
+                      static_cast<int>(ramp[i][1] + (ramp[i + 1][1] - ramp[i][1]) * f + 0.5f),
+                      static_cast<int>(ramp[i][2] + (ramp[i + 1][2] - ramp[i][2]) * f + 0.5f));
+}
+
+// Function to write per-pixel counts as a heatmap image, scaled to the largest count
+inline bool writeHeatmapPPM(const std::string& filename, const Framebuffer<Count32>& counts) {
+    uint32_t maxCount = 0;
+    for (uint32_t count : counts.pixels) maxCount = std::max(maxCount, count);
+    Framebuffer<RGB8> image(counts.width, counts.height);
+    for (size_t i = 0; i < counts.pixels.size(); ++i) image.pixels[i] = heatmapColor(counts.pixels[i], maxCount);
+    return writePPMFile(filename, image, PPM_BINARY);
+}
+
+// Face ID and barycentric weights of pixels no face was drawn on
+const uint32_t NO_FACE = 0xFFFFFFFF;
+
+// Function to write 16-bit big-endian samples as the pixel data of a PGM or PAM file
+inline bool writeSamples16(std::ostream& file, const std::vector<uint16_t>& samples) {
+    std::vector<uint8_t> bytes(samples.size() * 2);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        bytes[2 * i] = static_cast<uint8_t>(samples[i] >> 8);
+        bytes[2 * i + 1] = static_cast<uint8_t>(samples[i] & 0xFF);
+    }
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(file);
+}
+
+// Function to write 16-bit samples with depth channels per pixel as a PAM file
+inline bool writePAMFile(const std::string& filename, int width, int height, int depth, const char* tupleType,
+                         const std::vector<uint16_t>& samples) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file " << filename << std::endl;
+        return false;
+    }
+    file << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH " << depth << "\nMAXVAL 65535\nTUPLTYPE "
+         << tupleType << "\nENDHDR\n";
+    if (!writeSamples16(file, samples)) {
+        std::cerr << "Error: Could not write pixel data to " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to write the face IDs as a PAM file of two 16-bit channels per pixel, the
+// high and low half of the ID; pixels without a face hold NO_FACE (65535 65535)
+inline bool writeFaceIdPAM(const std::string& filename, const Framebuffer<FaceId32>& ids) {
+    std::vector<uint16_t> samples(ids.pixels.size() * 2);
+    for (size_t i = 0; i < ids.pixels.size(); ++i) {
+        samples[2 * i] = static_cast<uint16_t>(ids.pixels[i] >> 16);
+        samples[2 * i + 1] = static_cast<uint16_t>(ids.pixels[i] & 0xFFFF);
+    }
+    return writePAMFile(filename, ids.width, ids.height, 2, "FACE_ID", samples);
+}
+
+// Function to write the barycentric weights of all three vertices as a 16-bit RGB
+// PAM file; the first weight is what the two stored ones leave of 1. Pixels without
+// a face are black.
+inline bool writeBarycentricPAM(const std::string& filename, const Framebuffer<Barycentric16x2>& weights) {
+    std::vector<uint16_t> samples(weights.pixels.size() * 3, 0);
+    for (size_t i = 0; i < weights.pixels.size(); ++i) {
+        if (weights.pixels[i] == NO_FACE) continue;
+        int w1 = weights.pixels[i] & 0xFFFF, w2 = weights.pixels[i] >> 16;
+        samples[3 * i] = static_cast<uint16_t>(std::max(0, 65535 - w1 - w2));
+        samples[3 * i + 1] = static_cast<uint16_t>(w1);
+        samples[3 * i + 2] = static_cast<uint16_t>(w2);
+    }
+    return writePAMFile(filename, weights.width, weights.height, 3, "RGB", samples);
+}
+
+// Function to write a depth buffer as a 16-bit PGM file. Drawn depths are scaled from
+// [nearZ, farZ], their range, to 0-65534; pixels never drawn are 65535.
+inline bool writeDepthPGM(const std::string& filename, const Framebuffer<Depth32F>& depth, float& nearZ, float& farZ) {
+    nearZ = std::numeric_limits<float>::infinity();
+    farZ = -nearZ;
+    for (float z : depth.pixels) {
+        if (z == std::numeric_limits<float>::infinity()) continue;
+        nearZ = std::min(nearZ, z);
+        farZ = std::max(farZ, z);
+    }
+    float scale = farZ > nearZ ? 65534.0f / (farZ - nearZ) : 0.0f;
+    std::vector<uint16_t> samples(depth.pixels.size(), 65535);
+    for (size_t i = 0; i < depth.pixels.size(); ++i) {
+        float z = depth.pixels[i];
+        if (z != std::numeric_limits<float>::infinity()) samples[i] = static_cast<uint16_t>((z - nearZ) * scale + 0.5f);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file " << filename << std::endl;
+        return false;
+    }
+    file << "P5\n" << depth.width << " " << depth.height << "\n65535\n";
+    if (!writeSamples16(file, samples)) {
+        std::cerr << "Error: Could not write pixel data to " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to skip whitespace and # comments in a PPM header
+inline void skipPPMWhitespace(std::istream& file) {
+    int c;
+    while ((c = file.peek()) != EOF) {
+        if (std::isspace(c)) {
+            file.get();
+        } else if (c == '#') {
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        } else {
+            break;
+        }
+    }
+}
+
+// Function to read a P6 or P3 image into a framebuffer of any format
+template <typename Format>
+bool readPPMFile(const std::string& filename, Framebuffer<Format>& image) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+
+    // Read the header
+    std::string magic;
+    int width = 0, height = 0, maxValue = 0;
+    file >> magic;
+    if (magic != "P6" && magic != "P3") {
+        std::cerr << "Error: " << filename << " is not a P6 or P3 image" << std::endl;
+        return false;
+    }
+    skipPPMWhitespace(file);
+    file >> width;
+    skipPPMWhitespace(file);
+    file >> height;
+    skipPPMWhitespace(file);
+    file >> maxValue;
+    if (!file || width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255) {
+        std::cerr << "Error: Unsupported PPM header in " << filename << std::endl;
+        return false;
+    }
+    file.get(); // Single whitespace byte before the pixel data
+
+    // Read the pixel data one row at a time
+    image.resize(width, height);
+    std::vector<uint8_t> bytes(static_cast<size_t>(width) * 3);
+    for (int y = 0; y < height; ++y) {
+        if (magic == "P6") {
+            file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        } else {
+            for (uint8_t& b : bytes) {
+                int value = 0;
+                file >> value;
+                b = static_cast<uint8_t>(value);
+            }
+        }
+        if (!file) {
+            std::cerr << "Error: Unexpected end of file in " << filename << std::endl;
+            return false;
+        }
+        typename Format::Pixel* row = image.row(y);
+        for (int x = 0; x < width; ++x) {
+            const uint8_t* rgb = &bytes[3 * static_cast<size_t>(x)];
+            row[x] = Format::pack(rgb[0] * 255 / maxValue, rgb[1] * 255 / maxValue, rgb[2] * 255 / maxValue);
+        }
+    }
+    return true;
+}
+
+#endif
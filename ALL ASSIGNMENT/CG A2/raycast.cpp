@@ -0,0 +1,262 @@
+// Ray-casting renderer for the meshes drawn by barycen: it reads the same text,
+// .bmesh and OBJ files and writes the same PPM images, tracing rays through a
+// bounding volume hierarchy (bvh.h) instead of rasterizing.
+//
+// By default it casts one ray per pixel along z (primary visibility), which
+// sees what the rasterizer draws: the nearest face where the mesh has depth
+// (the first face of equal depth), the last face in painter's order where it
+// has not, with vertex colors interpolated the same way. Renders of the two can
+// be cross-checked with --compare; only colors truncated on the other side of
+// an integer by the rasterizer's float stepping may differ.
+//
+// --shadows casts a second ray from every visible point towards a directional
+// light and darkens the points it finds blocked, which the rasterizer cannot do.
+//
+// Usage: raycast [options] <input.txt | input.bmesh | input.obj>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "mesh_io.h"
+#include "obj_io.h"
+#include "framebuffer.h"
+#include "ppm_io.h"
+#include "bvh.h"
+
+using namespace std;
+
+const int RAY_TILE_SIZE = 16;     // Pixels are traced in square tiles of 2x2 packets, one tile per task
+const double SHADOW_LEVEL = 0.4;  // Brightness of points in shadow
+const double SHADOW_OFFSET = 1e-3; // Shadow rays start this far from the surface they leave
+
+struct TraceOptions {
+    RayCull cull = RAY_CULL_NONE;
+    bool shadows = false;
+    double light[3] = { -1, -1, -1 }; // Direction towards the light: up, left and in front of the image
+    float depthScale = 1;             // Pixels per unit of mesh depth, for shadows
+};
+
+// Function to compute the color of the point (u, v) of a face, as the rasterizer's
+// Gouraud shading does: the channels interpolated linearly and truncated
+void faceColor(const Face& face, double u, double v, int* rgb) {
+    int c[9];
+    for (int k = 0; k < 3; ++k) RGBA8::unpack(face.colors[k], &c[3 * k]);
+    bool flat = face.colors[0] == face.colors[1] && face.colors[0] == face.colors[2];
+    for (int j = 0; j < 3; ++j) {
+        rgb[j] = flat ? c[j] : static_cast<int>(c[j] + (c[3 + j] - c[j]) * u + (c[6 + j] - c[j]) * v);
+    }
+}
+
+// Function to trace the pixels of one tile, a 2x2 packet of rays at a time
+template <typename Format>
+void traceTile(Framebuffer<Format>& image, const MeshView& mesh, const BVH& bvh, const TraceOptions& options, int tileX, int tileY) {
+    const double inf = numeric_limits<double>::infinity();
+    const HitOrder order = mesh.z ? HIT_FIRST_FACE : HIT_LAST_FACE;
+    const int x1 = min(tileX + RAY_TILE_SIZE, image.width), y1 = min(tileY + RAY_TILE_SIZE, image.height);
+    for (int y = tileY; y < y1; y += 2) {
+        for (int x = tileX; x < x1; x += 2) {
+            // Primary rays through the four pixel centers, looking into the image
+            RayPacket primary;
+            for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+                int px = x + (i & 1), py = y + (i >> 1);
+                if (px < x1 && py < y1) {
+                    primary.setRay(i, px, py, 0, 0, 0, 1, -inf, inf);
+                } else {
+                    primary.disable(i);
+                }
+            }
+            PacketHit hit;
+            intersectPacket(bvh, primary, options.cull, order, hit);
+
+            int shadowed = 0;
+            if (options.shadows) {
+                RayPacket shadow;
+                for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+                    if (hit.face[i] == BVH_NO_HIT) {
+                        shadow.disable(i);
+                        continue;
+                    }
+                    shadow.setRay(i, primary.ox[i], primary.oy[i], hit.t[i], options.light[0], options.light[1], options.light[2],
+                                  SHADOW_OFFSET, inf);
+                    shadow.skipFace[i] = hit.face[i];
+                }
+                shadowed = occludedPacket(bvh, shadow);
+            }
+
+            for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+                if (hit.face[i] == BVH_NO_HIT) continue; // Background stays black
+                int rgb[3];
+                faceColor(mesh.faces[hit.face[i]], hit.u[i], hit.v[i], rgb);
+                if (shadowed >> i & 1) {
+                    for (int& channel : rgb) channel = static_cast<int>(channel * SHADOW_LEVEL);
+                }
+                image.store(x + (i & 1), y + (i >> 1), Format::pack(rgb[0], rgb[1], rgb[2]));
+            }
+        }
+    }
+}
+
+// Function to trace the whole image, the tiles shared out to threads
+template <typename Format>
+void traceImage(Framebuffer<Format>& image, const MeshView& mesh, const BVH& bvh, const TraceOptions& options, int threads) {
+    image.resize(mesh.width, mesh.height);
+    image.clear(Format::pack(0, 0, 0)); // Initialize to black
+    const int tilesX = (image.width + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE;
+    const int tilesY = (image.height + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE;
+    atomic<int> nextTile(0);
+    auto worker = [&] {
+        for (int tile = nextTile++; tile < tilesX * tilesY; tile = nextTile++) {
+            traceTile(image, mesh, bvh, options, (tile % tilesX) * RAY_TILE_SIZE, (tile / tilesX) * RAY_TILE_SIZE);
+        }
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker);
+    worker();
+    for (thread& t : workers) t.join();
+}
+
+// Function to count the pixels that differ between the render and a reference image
+bool compareImages(const Framebuffer<DefaultFormat>& image, const string& referenceFile) {
+    Framebuffer<DefaultFormat> reference;
+    if (!readPPMFile(referenceFile, reference)) return false;
+    if (reference.width != image.width || reference.height != image.height) {
+        cerr << "Error: " << referenceFile << " is " << reference.width << "x" << reference.height << ", the render is "
+             << image.width << "x" << image.height << endl;
+        return false;
+    }
+    long long differing = 0;
+    int maxDifference = 0;
+    for (int y = 0; y < image.height; ++y) {
+        for (int x = 0; x < image.width; ++x) {
+            int a[3], b[3];
+            DefaultFormat::unpack(image.row(y)[x], a);
+            DefaultFormat::unpack(reference.row(y)[x], b);
+            int difference = max(abs(a[0] - b[0]), max(abs(a[1] - b[1]), abs(a[2] - b[2])));
+            differing += difference > 0;
+            maxDifference = max(maxDifference, difference);
+        }
+    }
+    cout << differing << " of " << static_cast<long long>(image.width) * image.height << " pixels differ from "
+         << referenceFile << " (largest channel difference " << maxDifference << ")" << endl;
+    return true;
+}
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void printUsage() {
+    cout << "Usage: raycast [options] <input.txt | input.bmesh | input.obj>" << endl;
+    cout << "  -o <file>     output image (default: input name with .ppm)" << endl;
+    cout << "  --p3          write ASCII P3 instead of binary P6" << endl;
+    cout << "  --size <n>    longer side of the image an OBJ model is fitted to (default 1024)" << endl;
+    cout << "  --cull <mode> ignore triangles wound none (default), cw or ccw on screen, as barycen" << endl;
+    cout << "  --shadows     darken points a directional light cannot reach" << endl;
+    cout << "  --light <x> <y> <z>  direction towards the light, x right, y down, z into the image (default -1 -1 -1)" << endl;
+    cout << "  --depth-scale <s>    pixels per unit of mesh depth, for shadows (default 1)" << endl;
+    cout << "  --threads <n> build and trace threads (default: one per core)" << endl;
+    cout << "  --compare <f> report how many pixels differ from a reference PPM, e.g. barycen's render" << endl;
+    cout << "  --bench <n>   build the tree and trace the image n times and report the fastest" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    string inputFile, outputFile, compareFile;
+    PPMEncoding encoding = PPM_BINARY;
+    TraceOptions options;
+    int objImageSize = OBJ_DEFAULT_IMAGE_SIZE;
+    int threads = 0;
+    int benchRuns = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg == "--p3") {
+            encoding = PPM_ASCII;
+        } else if (arg == "--size" && i + 1 < argc) {
+            objImageSize = max(1, atoi(argv[++i]));
+        } else if (arg == "--cull" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "none") {
+                options.cull = RAY_CULL_NONE;
+            } else if (mode == "cw") {
+                options.cull = RAY_CULL_NEGATIVE;
+            } else if (mode == "ccw") {
+                options.cull = RAY_CULL_POSITIVE;
+            } else {
+                cerr << "Error: unknown cull mode '" << mode << "' (expected none, cw or ccw)" << endl;
+                return 1;
+            }
+        } else if (arg == "--shadows") {
+            options.shadows = true;
+        } else if (arg == "--light" && i + 3 < argc) {
+            for (double& d : options.light) d = atof(argv[++i]);
+        } else if (arg == "--depth-scale" && i + 1 < argc) {
+            options.depthScale = static_cast<float>(atof(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--compare" && i + 1 < argc) {
+            compareFile = argv[++i];
+        } else if (arg == "--bench" && i + 1 < argc) {
+            benchRuns = max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            cerr << "Error: unknown or incomplete option '" << arg << "'" << endl;
+            printUsage();
+            return 1;
+        } else {
+            inputFile = arg;
+        }
+    }
+    if (inputFile.empty()) {
+        printUsage();
+        return 1;
+    }
+    if (outputFile.empty()) {
+        outputFile = inputFile.substr(0, inputFile.find_last_of('.')) + ".ppm";
+    }
+    if (options.light[0] == 0 && options.light[1] == 0 && options.light[2] == 0) {
+        cerr << "Error: --light needs a nonzero direction" << endl;
+        return 1;
+    }
+    if (threads == 0) threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+
+    LoadedMesh mesh;
+    string error;
+    bool loaded = isObjFile(inputFile) ? loadObjMesh(inputFile, objImageSize, mesh, error) : loadMesh(inputFile, mesh, error);
+    if (!loaded) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+
+    BVH bvh;
+    Framebuffer<DefaultFormat> image;
+    double buildMs = 0, traceMs = 0;
+    for (int run = 0; run < benchRuns; ++run) {
+        auto start = chrono::steady_clock::now();
+        buildBVH(mesh.view, options.depthScale, threads, bvh);
+        double build = elapsedMs(start);
+        start = chrono::steady_clock::now();
+        traceImage(image, mesh.view, bvh, options, threads);
+        double trace = elapsedMs(start);
+        buildMs = run == 0 ? build : min(buildMs, build);
+        traceMs = run == 0 ? trace : min(traceMs, trace);
+    }
+    double pixels = static_cast<double>(image.width) * image.height;
+    cout << "Built a BVH of " << bvh.nodes.size() << " nodes over " << bvh.triangles.size() << " triangles in " << buildMs
+         << " ms; traced " << image.width << "x" << image.height << " pixels in " << traceMs << " ms ("
+         << pixels / max(traceMs, 1e-3) / 1000 << " Mpixels/s)" << endl;
+
+    if (!writePPMFile(outputFile, image, encoding)) return 1;
+    cout << "Image saved as " << outputFile << endl;
+    if (!compareFile.empty() && !compareImages(image, compareFile)) return 1;
+    return 0;
+}
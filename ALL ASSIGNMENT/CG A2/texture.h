@@ -0,0 +1,186 @@
+// Textures for the rasterizer: an RGBA8 image with a precomputed mip pyramid.
+// Each level is stored in 8x8 tiles, tiles in row-major order and the 64 texels
+// of a tile in Morton (Z) order, so the 2x2 footprint of a bilinear sample and
+// the texels of nearby pixels usually share a cache line.
+// Texture coordinates wrap (repeat); u runs to the right and v down the image.
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "framebuffer.h"
+#include "ppm_io.h"
+
+enum TextureFilter {
+    FILTER_NEAREST,   // Nearest texel of the nearest mip level
+    FILTER_BILINEAR,  // 2x2 texels of the nearest mip level
+    FILTER_TRILINEAR  // Bilinear samples of the two nearest mip levels, blended
+};
+
+const int TEXTURE_TILE_SHIFT = 3;
+const int TEXTURE_TILE_SIZE = 1 << TEXTURE_TILE_SHIFT;
+
+// Interleave the bits of 3-bit x and y into a 6-bit Morton index
+inline int mortonIndex8(int x, int y) {
+    int index = 0;
+    for (int bit = 0; bit < TEXTURE_TILE_SHIFT; ++bit) {
+        index |= ((x >> bit) & 1) << (2 * bit);
+        index |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return index;
+}
+
+// One mip level in tiled Morton order
+struct TextureLevel {
+    int width = 0, height = 0;
+    int tilesX = 0;
+    std::vector<uint32_t> texels; // RGBA8, padded to whole tiles
+    uint8_t morton[TEXTURE_TILE_SIZE][TEXTURE_TILE_SIZE]; // Morton index of (y, x) within a tile
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        tilesX = (w + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+        int tilesY = (h + TEXTURE_TILE_SIZE - 1) >> TEXTURE_TILE_SHIFT;
+        texels.assign(static_cast<size_t>(tilesX) * tilesY * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE, 0);
+        for (int y = 0; y < TEXTURE_TILE_SIZE; ++y) {
+            for (int x = 0; x < TEXTURE_TILE_SIZE; ++x) {
+                morton[y][x] = static_cast<uint8_t>(mortonIndex8(x, y));
+            }
+        }
+    }
+
+    size_t address(int x, int y) const {
+        size_t tile = static_cast<size_t>(y >> TEXTURE_TILE_SHIFT) * tilesX + (x >> TEXTURE_TILE_SHIFT);
+        return (tile << (2 * TEXTURE_TILE_SHIFT)) + morton[y & (TEXTURE_TILE_SIZE - 1)][x & (TEXTURE_TILE_SIZE - 1)];
+    }
+
+    uint32_t fetch(int x, int y) const { return texels[address(x, y)]; }
+    void store(int x, int y, uint32_t texel) { texels[address(x, y)] = texel; }
+};
+
+// Texel color as floats, for filtering
+struct TexelColor {
+    float r, g, b;
+};
+
+inline TexelColor unpackTexel(uint32_t texel) {
+    return TexelColor{ static_cast<float>(texel & 0xFF), static_cast<float>((texel >> 8) & 0xFF),
+                       static_cast<float>((texel >> 16) & 0xFF) };
+}
+
+inline TexelColor mixTexel(const TexelColor& a, const TexelColor& b, float t) {
+    return TexelColor{ a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t };
+}
+
+// Wrap a texture coordinate into [0, 1) before it is scaled and converted to a
+// texel, so huge values cannot overflow the conversion; NaN and infinity become 0
+inline float wrapCoordinate(float t) {
+    float f = t - std::floor(t);
+    return f >= 0 && f < 1 ? f : 0.0f;
+}
+
+// Wrap an integer texel coordinate into [0, size)
+inline int wrapTexel(int i, int size) {
+    i %= size;
+    return i < 0 ? i + size : i;
+}
+
+struct Texture {
+    std::vector<TextureLevel> levels; // levels[0] is the full-size image
+
+    // Function to build the tiled base level and every mip level down to 1x1
+    void build(const Framebuffer<RGBA8>& image) {
+        levels.clear();
+        levels.emplace_back();
+        levels[0].resize(image.width, image.height);
+        for (int y = 0; y < image.height; ++y) {
+            const uint32_t* row = image.row(y);
+            for (int x = 0; x < image.width; ++x) levels[0].store(x, y, row[x]);
+        }
+
+        // Each level averages 2x2 texels of the previous one (edges are clamped for odd sizes)
+        while (levels.back().width > 1 || levels.back().height > 1) {
+            const TextureLevel& src = levels.back();
+            TextureLevel next;
+            next.resize(std::max(1, src.width / 2), std::max(1, src.height / 2));
+            for (int y = 0; y < next.height; ++y) {
+                for (int x = 0; x < next.width; ++x) {
+                    int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+                    int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+                    uint32_t t[4] = { src.fetch(x0, y0), src.fetch(x1, y0), src.fetch(x0, y1), src.fetch(x1, y1) };
+                    int sum[3] = { 0, 0, 0 };
+                    for (uint32_t texel : t) {
+                        sum[0] += texel & 0xFF;
+                        sum[1] += (texel >> 8) & 0xFF;
+                        sum[2] += (texel >> 16) & 0xFF;
+                    }
+                    next.store(x, y, RGBA8::pack((sum[0] + 2) / 4, (sum[1] + 2) / 4, (sum[2] + 2) / 4));
+                }
+            }
+            levels.push_back(std::move(next));
+        }
+    }
+
+    int maxLevel() const { return static_cast<int>(levels.size()) - 1; }
+
+    // Nearest texel of one level
+    TexelColor sampleNearest(int level, float u, float v) const {
+        const TextureLevel& l = levels[level];
+        u = wrapCoordinate(u);
+        v = wrapCoordinate(v);
+        int x = wrapTexel(static_cast<int>(std::floor(u * l.width)), l.width);
+        int y = wrapTexel(static_cast<int>(std::floor(v * l.height)), l.height);
+        return unpackTexel(l.fetch(x, y));
+    }
+
+    // Bilinear blend of the 2x2 texels around (u, v) in one level
+    TexelColor sampleBilinear(int level, float u, float v) const {
+        const TextureLevel& l = levels[level];
+        u = wrapCoordinate(u);
+        v = wrapCoordinate(v);
+        float fx = u * l.width - 0.5f, fy = v * l.height - 0.5f;
+        float x0f = std::floor(fx), y0f = std::floor(fy);
+        float tx = fx - x0f, ty = fy - y0f;
+        int x0 = wrapTexel(static_cast<int>(x0f), l.width), x1 = x0 + 1 == l.width ? 0 : x0 + 1;
+        int y0 = wrapTexel(static_cast<int>(y0f), l.height), y1 = y0 + 1 == l.height ? 0 : y0 + 1;
+        TexelColor top = mixTexel(unpackTexel(l.fetch(x0, y0)), unpackTexel(l.fetch(x1, y0)), tx);
+        TexelColor bottom = mixTexel(unpackTexel(l.fetch(x0, y1)), unpackTexel(l.fetch(x1, y1)), tx);
+        return mixTexel(top, bottom, ty);
+    }
+
+    // Filtered sample at level of detail lod (log2 of texels per pixel). The filter is
+    // a template parameter so shaders compile a sampler without the filter switch.
+    template <TextureFilter Filter>
+    TexelColor sample(float u, float v, float lod) const {
+        lod = lod > 0 ? std::min(lod, static_cast<float>(maxLevel())) : 0.0f; // NaN picks the base level
+        if (Filter == FILTER_NEAREST) return sampleNearest(static_cast<int>(lod + 0.5f), u, v);
+        if (Filter == FILTER_BILINEAR) return sampleBilinear(static_cast<int>(lod + 0.5f), u, v);
+        int level = static_cast<int>(lod);
+        if (level >= maxLevel()) return sampleBilinear(maxLevel(), u, v);
+        return mixTexel(sampleBilinear(level, u, v), sampleBilinear(level + 1, u, v), lod - level);
+    }
+
+    // Level of detail for the given screen-space derivatives of u and v
+    float levelOfDetail(double dudx, double dvdx, double dudy, double dvdy) const {
+        double w = levels[0].width, h = levels[0].height;
+        double rhoX = (dudx * w) * (dudx * w) + (dvdx * h) * (dvdx * h);
+        double rhoY = (dudy * w) * (dudy * w) + (dvdy * h) * (dvdy * h);
+        double rho2 = std::max(rhoX, rhoY);
+        return rho2 > 0 ? static_cast<float>(0.5 * std::log2(rho2)) : 0.0f;
+    }
+};
+
+// Function to load a PPM image as a texture
+inline bool loadTexture(const std::string& filename, Texture& texture) {
+    Framebuffer<RGBA8> image;
+    if (!readPPMFile(filename, image)) return false;
+    texture.build(image);
+    return true;
+}
+
+#endif
@@ -0,0 +1,323 @@
+// Vertex transform stage: model/view/projection matrices, a camera and the
+// viewport mapping from a mesh's model-space vertices to screen space.
+//
+// Model space is the mesh's own coordinate system: x to the right, y down and
+// z away from the viewer, in pixels of the mesh's image. The camera uses the
+// same orientation (x right, y down, looking along +z), so the default camera
+// reproduces the original image on the plane through the image center.
+//
+// Vertices are kept structure-of-arrays as floats, padded to whole blocks of
+// 8, and transformed one block at a time (with AVX when the compiler targets
+// it). The output buffers are reused, so a new camera costs no allocation.
+// The model-space buffer is read-only once built and can be shared by threads
+// projecting different frames.
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#include "mesh_io.h"
+
+// Row-major 4x4 matrix; points are column vectors (p' = M * p)
+struct Mat4 {
+    float m[4][4];
+
+    static Mat4 identity() {
+        Mat4 r = {};
+        for (int i = 0; i < 4; ++i) r.m[i][i] = 1;
+        return r;
+    }
+
+    Mat4 operator*(const Mat4& o) const {
+        Mat4 r = {};
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                for (int k = 0; k < 4; ++k) r.m[i][j] += m[i][k] * o.m[k][j];
+            }
+        }
+        return r;
+    }
+};
+
+struct Vec3 {
+    float x, y, z;
+};
+
+inline Vec3 operator-(const Vec3& a, const Vec3& b) { return Vec3{ a.x - b.x, a.y - b.y, a.z - b.z }; }
+
+inline Vec3 cross(const Vec3& a, const Vec3& b) {
+    return Vec3{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+inline Vec3 normalize(const Vec3& a) {
+    float length = std::sqrt(dot(a, a));
+    return Vec3{ a.x / length, a.y / length, a.z / length };
+}
+
+inline Mat4 translation(float x, float y, float z) {
+    Mat4 r = Mat4::identity();
+    r.m[0][3] = x;
+    r.m[1][3] = y;
+    r.m[2][3] = z;
+    return r;
+}
+
+// Rotation by angle (radians) about the x axis (tilts y towards z)
+inline Mat4 rotationX(float angle) {
+    Mat4 r = Mat4::identity();
+    float c = std::cos(angle), s = std::sin(angle);
+    r.m[1][1] = c; r.m[1][2] = -s;
+    r.m[2][1] = s; r.m[2][2] = c;
+    return r;
+}
+
+// Rotation by angle (radians) about the y axis (turns z towards x)
+inline Mat4 rotationY(float angle) {
+    Mat4 r = Mat4::identity();
+    float c = std::cos(angle), s = std::sin(angle);
+    r.m[0][0] = c; r.m[0][2] = s;
+    r.m[2][0] = -s; r.m[2][2] = c;
+    return r;
+}
+
+// View matrix of a camera at eye looking at target, with down giving the screen's downward direction
+inline Mat4 lookAt(const Vec3& eye, const Vec3& target, const Vec3& down) {
+    Vec3 forward = normalize(target - eye);
+    Vec3 right = normalize(cross(down, forward));
+    Vec3 below = cross(forward, right); // Camera y axis, pointing down the screen
+    Mat4 r = Mat4::identity();
+    const Vec3 axes[3] = { right, below, forward };
+    for (int i = 0; i < 3; ++i) {
+        r.m[i][0] = axes[i].x;
+        r.m[i][1] = axes[i].y;
+        r.m[i][2] = axes[i].z;
+        r.m[i][3] = -dot(axes[i], eye);
+    }
+    return r;
+}
+
+// Perspective projection to clip space with vertical field of view fovY (radians).
+// Clip w is the view distance, for perspective-correct interpolation, and clip z
+// is -1, so the depth after the divide is -1 / distance: nearer is smaller and,
+// unlike the distance itself, it is linear across the screen, as the depth test
+// interpolates it.
+inline Mat4 perspectiveProjection(float fovY, float aspect) {
+    float f = 1.0f / std::tan(fovY / 2);
+    Mat4 r = {};
+    r.m[0][0] = f / aspect;
+    r.m[1][1] = f;
+    r.m[2][3] = -1;
+    r.m[3][2] = 1;
+    return r;
+}
+
+// Orthographic projection of a width x height region of the view plane; clip z is the view distance
+inline Mat4 orthographicProjection(float width, float height) {
+    Mat4 r = Mat4::identity();
+    r.m[0][0] = 2 / width;
+    r.m[1][1] = 2 / height;
+    return r;
+}
+
+// Matrix of a 2D affine transform given as the six parameters a1 a2 b1 a3 a4 b2
+// of Transformation.cpp: x' = a1 * x + a2 * y + b1, y' = a3 * x + a4 * y + b2
+inline Mat4 affineMatrix(const float* params) {
+    Mat4 r = Mat4::identity();
+    r.m[0][0] = params[0]; r.m[0][1] = params[1]; r.m[0][3] = params[2];
+    r.m[1][0] = params[3]; r.m[1][1] = params[4]; r.m[1][3] = params[5];
+    return r;
+}
+
+// Camera orbiting the center of the mesh's image
+struct Camera {
+    float yaw = 0;       // Rotation about the vertical axis, in degrees
+    float pitch = 0;     // Rotation about the horizontal axis, in degrees
+    float fovY = 60;     // Vertical field of view, in degrees
+    float distance = 1;  // Distance from the center, relative to the one that keeps the image size
+    float nearZ = 1;     // Triangles with a vertex closer than this are culled
+    bool orthographic = false; // Parallel projection; distance then scales the visible region
+
+    // Function to compute the view and projection for an image of the given size,
+    // orbiting the point (width / 2, height / 2, centerZ)
+    Mat4 viewProjection(int width, int height, float centerZ) const {
+        const float degrees = 3.14159265358979f / 180;
+        float fit = (height / 2.0f) / std::tan(fovY * degrees / 2); // Distance at which the image plane fills the view
+        Vec3 center = { width / 2.0f, height / 2.0f, centerZ };
+        Mat4 orbit = rotationY(yaw * degrees) * rotationX(pitch * degrees);
+        Vec3 offset = { orbit.m[0][2] * -fit * distance, orbit.m[1][2] * -fit * distance, orbit.m[2][2] * -fit * distance };
+        Vec3 eye = { center.x + offset.x, center.y + offset.y, center.z + offset.z };
+        Vec3 down = { orbit.m[0][1], orbit.m[1][1], orbit.m[2][1] };
+        Mat4 projection = orthographic ? orthographicProjection(width * distance, height * distance)
+                                       : perspectiveProjection(fovY * degrees, static_cast<float>(width) / height);
+        return projection * lookAt(eye, center, down);
+    }
+};
+
+const uint32_t TRANSFORM_BLOCK = 8; // Vertices per transform block
+
+// Model-space vertex positions, structure-of-arrays, padded to whole blocks
+struct VertexBuffer {
+    std::vector<float> x, y, z;
+    uint32_t count = 0;
+    float centerZ = 0; // Middle of the depth range, the point cameras orbit around
+
+    // Function to convert the vertices of a mesh (missing z is 0)
+    void assign(const MeshView& mesh) {
+        count = mesh.numVertices;
+        centerZ = 0;
+        if (mesh.z && count > 0) {
+            auto range = std::minmax_element(mesh.z, mesh.z + count);
+            centerZ = (*range.first + *range.second) / 2;
+        }
+        size_t padded = (static_cast<size_t>(count) + TRANSFORM_BLOCK - 1) / TRANSFORM_BLOCK * TRANSFORM_BLOCK;
+        x.assign(padded, 0.0f);
+        y.assign(padded, 0.0f);
+        z.assign(padded, 0.0f);
+        for (uint32_t i = 0; i < count; ++i) {
+            x[i] = static_cast<float>(mesh.x[i]);
+            y[i] = static_cast<float>(mesh.y[i]);
+            if (mesh.z) z[i] = mesh.z[i];
+        }
+    }
+};
+
+// Screen-space vertices written by the transform stage
+struct ScreenVertices {
+    std::vector<int32_t> x, y;
+    std::vector<float> z; // Depth (clip z / w: the view distance, or -1 / view distance under perspective)
+    std::vector<float> w; // Perspective divisor
+};
+
+// Screen coordinates are clamped to this range; far larger than the guard band, so
+// clamped vertices are always clipped and never wrap around
+const float SCREEN_COORDINATE_LIMIT = 1 << 30;
+
+// Function to transform the vertices by the model-view-projection matrix and map
+// them to a width x height viewport with pixel centers at integer coordinates
+inline void transformVertices(const VertexBuffer& in, const Mat4& mvp, int width, int height, ScreenVertices& out) {
+    size_t padded = in.x.size();
+    out.x.resize(padded);
+    out.y.resize(padded);
+    out.z.resize(padded);
+    out.w.resize(padded);
+    const float halfW = width / 2.0f, halfH = height / 2.0f;
+    const float (*m)[4] = mvp.m;
+
+#ifdef __AVX__
+    auto row = [&](int r, __m256 x, __m256 y, __m256 z) {
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[r][0]), x), _mm256_mul_ps(_mm256_set1_ps(m[r][1]), y));
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(m[r][2]), z));
+        return _mm256_add_ps(v, _mm256_set1_ps(m[r][3]));
+    };
+    const __m256 low = _mm256_set1_ps(-SCREEN_COORDINATE_LIMIT), high = _mm256_set1_ps(SCREEN_COORDINATE_LIMIT);
+    for (size_t i = 0; i < padded; i += TRANSFORM_BLOCK) {
+        __m256 x = _mm256_loadu_ps(&in.x[i]), y = _mm256_loadu_ps(&in.y[i]), z = _mm256_loadu_ps(&in.z[i]);
+        __m256 w = row(3, x, y, z);
+        __m256 invW = _mm256_div_ps(_mm256_set1_ps(1.0f), w);
+        // Viewport: screen = (ndc + 1) * size / 2; max comes first so NaN becomes the lower limit
+        __m256 sx = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(row(0, x, y, z), invW), _mm256_set1_ps(1.0f)), _mm256_set1_ps(halfW));
+        __m256 sy = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(row(1, x, y, z), invW), _mm256_set1_ps(1.0f)), _mm256_set1_ps(halfH));
+        sx = _mm256_min_ps(_mm256_max_ps(sx, low), high);
+        sy = _mm256_min_ps(_mm256_max_ps(sy, low), high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&out.x[i]), _mm256_cvtps_epi32(sx));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&out.y[i]), _mm256_cvtps_epi32(sy));
+        _mm256_storeu_ps(&out.z[i], _mm256_mul_ps(row(2, x, y, z), invW));
+        _mm256_storeu_ps(&out.w[i], w);
+    }
+#else
+    // The same block computation written lane by lane, for the compiler to vectorize
+    for (size_t i = 0; i < padded; i += TRANSFORM_BLOCK) {
+        const float* x = &in.x[i];
+        const float* y = &in.y[i];
+        const float* z = &in.z[i];
+        float sx[TRANSFORM_BLOCK], sy[TRANSFORM_BLOCK];
+        for (uint32_t k = 0; k < TRANSFORM_BLOCK; ++k) {
+            float w = m[3][0] * x[k] + m[3][1] * y[k] + m[3][2] * z[k] + m[3][3];
+            float invW = 1.0f / w;
+            sx[k] = ((m[0][0] * x[k] + m[0][1] * y[k] + m[0][2] * z[k] + m[0][3]) * invW + 1.0f) * halfW;
+            sy[k] = ((m[1][0] * x[k] + m[1][1] * y[k] + m[1][2] * z[k] + m[1][3]) * invW + 1.0f) * halfH;
+            out.z[i + k] = (m[2][0] * x[k] + m[2][1] * y[k] + m[2][2] * z[k] + m[2][3]) * invW;
+            out.w[i + k] = w;
+        }
+        for (uint32_t k = 0; k < TRANSFORM_BLOCK; ++k) {
+            float cx = sx[k] > -SCREEN_COORDINATE_LIMIT ? sx[k] : -SCREEN_COORDINATE_LIMIT; // NaN becomes the lower limit
+            float cy = sy[k] > -SCREEN_COORDINATE_LIMIT ? sy[k] : -SCREEN_COORDINATE_LIMIT;
+            out.x[i + k] = static_cast<int32_t>(std::nearbyint(std::min(cx, SCREEN_COORDINATE_LIMIT)));
+            out.y[i + k] = static_cast<int32_t>(std::nearbyint(std::min(cy, SCREEN_COORDINATE_LIMIT)));
+        }
+    }
+#endif
+}
+
+// Function to project a mesh whose vertices were converted into model, applying
+// modelMatrix and then the camera, into screen. The returned view shares the faces
+// and texture coordinates of mesh and has screen-space positions. The projected
+// depth becomes its depth only if mesh had depth, so flat meshes are still drawn
+// in painter's order.
+inline MeshView projectMesh(const MeshView& mesh, const VertexBuffer& model, const Mat4& modelMatrix, const Camera& camera,
+                            ScreenVertices& screen) {
+    Mat4 mvp = camera.viewProjection(mesh.width, mesh.height, model.centerZ) * modelMatrix;
+    transformVertices(model, mvp, mesh.width, mesh.height, screen);
+    MeshView view = mesh;
+    view.x = screen.x.data();
+    view.y = screen.y.data();
+    view.z = mesh.z ? screen.z.data() : nullptr;
+    if (!camera.orthographic) {
+        view.w = screen.w.data();
+        view.nearZ = camera.nearZ;
+    }
+    return view;
+}
+
+// Transform stage of one mesh: converts the vertices once, then projects them
+// for any number of cameras into reused buffers
+struct TransformStage {
+    VertexBuffer model;
+    ScreenVertices screen;
+
+    void load(const MeshView& mesh) { model.assign(mesh); }
+
+    MeshView project(const MeshView& mesh, const Mat4& modelMatrix, const Camera& camera) {
+        return projectMesh(mesh, model, modelMatrix, camera, screen);
+    }
+};
+
+// Function to read a sequence of 2D affine transforms, one frame per line in the
+// six-parameter form of affineMatrix; on failure returns false and sets error
+inline bool readAffineFrames(const std::string& filename, std::vector<Mat4>& frames, std::string& error) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        error = "could not open file " + filename;
+        return false;
+    }
+    MeshTextCursor in(file.data(), file.data() + file.size());
+    frames.clear();
+    while (in.nextDataLine()) {
+        float params[6];
+        for (float& value : params) {
+            if (!in.readFloat(value, "6 affine parameters")) {
+                error = filename + ": " + in.error;
+                return false;
+            }
+        }
+        frames.push_back(affineMatrix(params));
+        in.skipRestOfLine();
+    }
+    if (frames.empty()) {
+        error = filename + ": no frames";
+        return false;
+    }
+    return true;
+}
+
+#endif